@@ -0,0 +1,49 @@
+# Copyright (C) 2018  Christian Berger
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+###########################################################################
+# Find liburing.
+FIND_PATH(URING_INCLUDE_DIR
+          NAMES liburing.h
+          PATHS /usr/local/include/
+                /usr/include/)
+MARK_AS_ADVANCED(URING_INCLUDE_DIR)
+FIND_LIBRARY(URING_LIBRARY
+             NAMES uring
+             PATHS ${LIBURINGDIR}/lib/
+                    /usr/lib/arm-linux-gnueabihf/
+                    /usr/lib/arm-linux-gnueabi/
+                    /usr/lib/x86_64-linux-gnu/
+                    /usr/local/lib64/
+                    /usr/lib64/
+                    /usr/lib/)
+MARK_AS_ADVANCED(URING_LIBRARY)
+
+###########################################################################
+IF (URING_INCLUDE_DIR
+    AND URING_LIBRARY)
+    SET(URING_FOUND 1)
+    SET(URING_LIBRARIES ${URING_LIBRARY})
+    SET(URING_INCLUDE_DIRS ${URING_INCLUDE_DIR})
+ENDIF()
+
+MARK_AS_ADVANCED(URING_LIBRARIES)
+MARK_AS_ADVANCED(URING_INCLUDE_DIRS)
+
+IF (URING_FOUND)
+    MESSAGE(STATUS "Found liburing: ${URING_INCLUDE_DIRS}, ${URING_LIBRARIES}")
+ELSE ()
+    MESSAGE(STATUS "Could not find liburing")
+ENDIF()
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "recording-file.hpp"
+
+// Measures the recording throughput of RecordingFile with buffered and with
+// direct I/O (io_uring when built with liburing, the writer thread
+// otherwise) in the given directory, e.g. a tmpfs and a local file system:
+//
+//   benchmark-recording-file <directory> [<MiB>] [<frame bytes>]
+//
+// Frames are written as head, data and tail with writev, as the recorder
+// does. Besides the throughput, the longest time a single frame blocked the
+// caller is printed, as that is what holds up the recorder.
+
+struct Result {
+  double mibPerSecond;
+  double maxFrameMilliseconds;
+};
+
+static Result run(std::string const &name, bool isDirectIo, uint64_t bytes,
+    size_t frameBytes)
+{
+  std::string head(32, 'h');
+  std::string tail(16, 't');
+  std::vector<char> data(frameBytes);
+  for (size_t i = 0; i < frameBytes; ++i) {
+    data[i] = static_cast<char>(i);
+  }
+
+  double maxFrameMilliseconds{0.0};
+  auto const start = std::chrono::steady_clock::now();
+  {
+    RecordingFile file(name, 0, isDirectIo);
+    for (uint64_t written = 0; written < bytes;
+        written += head.size() + frameBytes + tail.size()) {
+      struct iovec iov[3];
+      iov[0].iov_base = const_cast<char *>(head.data());
+      iov[0].iov_len = head.size();
+      iov[1].iov_base = data.data();
+      iov[1].iov_len = data.size();
+      iov[2].iov_base = const_cast<char *>(tail.data());
+      iov[2].iov_len = tail.size();
+      auto const before = std::chrono::steady_clock::now();
+      if (!file.write(iov, 3)) {
+        std::cerr << "Writing " << name << " failed." << std::endl;
+        break;
+      }
+      maxFrameMilliseconds = std::max(maxFrameMilliseconds,
+          std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - before).count());
+    }
+    // Closing waits for the outstanding writes.
+  }
+  // Buffered data is only on the disk once synced.
+  ::sync();
+  double const seconds{std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count()};
+  ::unlink(name.c_str());
+  return Result{static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds,
+    maxFrameMilliseconds};
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <directory> [<MiB>] "
+      << "[<frame bytes>]" << std::endl;
+    return 1;
+  }
+  std::string const name{std::string(argv[1]) + "/benchmark-recording-file.rec"};
+  uint64_t const bytes{((argc > 2) ? std::stoull(argv[2]) : 1024ULL)
+    * 1024 * 1024};
+  size_t const frameBytes{(argc > 3) ?
+    static_cast<size_t>(std::stoull(argv[3])) : 200 * 1024};
+
+#ifdef HAVE_LIBURING
+  std::string const backend{"io_uring"};
+#else
+  std::string const backend{"writer thread"};
+#endif
+  for (bool const isDirectIo : {false, true}) {
+    Result const result{run(name, isDirectIo, bytes, frameBytes)};
+    std::cout << (isDirectIo ? "Direct I/O (" + backend + ")" : "Buffered")
+      << ": " << result.mibPerSecond << " MiB/s, longest frame "
+      << result.maxFrameMilliseconds << " ms" << std::endl;
+  }
+  return 0;
+}
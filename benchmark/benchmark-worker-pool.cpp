@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cluon-complete.hpp"
+#include "worker-pool.hpp"
+
+// Compares handing jobs to a worker through the WorkerPool (lock-free SPSC
+// ring, eventfd wakeups) with cluon's NotifyingPipeline (mutex, deque and
+// condition variable), which the decoder used before:
+//
+//   benchmark-worker-pool [<jobs>] [<rate in Hz>] [<worker spin in us>]
+//
+// Burst: the jobs are posted back to back, giving the jobs per second. Paced:
+// the jobs are posted at the given rate, as packets or frames arrive, giving
+// the time from posting a job to it running. Results depend a lot on the
+// number of cores; with a single core both sides share it.
+
+using Clock = std::chrono::steady_clock;
+
+struct Latencies {
+  std::vector<double> microseconds{};
+
+  void print(std::string const &name) const
+  {
+    std::vector<double> sorted{microseconds};
+    std::sort(sorted.begin(), sorted.end());
+    if (sorted.empty()) {
+      return;
+    }
+    std::cout << name << ": p50 " << sorted[sorted.size() / 2] << " us, p99 "
+      << sorted[sorted.size() * 99 / 100] << " us, max " << sorted.back()
+      << " us" << std::endl;
+  }
+};
+
+static void waitUntil(Clock::time_point const &time)
+{
+  // Sleeping is too coarse for high rates, so the last part is spun.
+  auto const sleepUntil = time - std::chrono::microseconds(100);
+  if (Clock::now() < sleepUntil) {
+    std::this_thread::sleep_until(sleepUntil);
+  }
+  while (Clock::now() < time) {
+  }
+}
+
+static double burstPool(uint32_t jobs, std::chrono::microseconds const &spin)
+{
+  WorkerPool pool(1, {}, 0, spin);
+  WorkerPool::Producer producer{pool.connect(0, 1024)};
+  std::atomic<uint32_t> done{0};
+  auto const start = Clock::now();
+  for (uint32_t i = 0; i < jobs; ++i) {
+    while (!producer.post([&done]() { done++; })) {
+      std::this_thread::yield();
+    }
+  }
+  pool.drain();
+  double const seconds{std::chrono::duration<double>(
+      Clock::now() - start).count()};
+  return done.load() / seconds;
+}
+
+static double burstPipeline(uint32_t jobs)
+{
+  std::atomic<uint32_t> done{0};
+  cluon::NotifyingPipeline<uint32_t> pipeline([&done](uint32_t &&) {
+      done++;
+    });
+  auto const start = Clock::now();
+  for (uint32_t i = 0; i < jobs; ++i) {
+    uint32_t entry{i};
+    pipeline.add(std::move(entry));
+    pipeline.notifyAll();
+  }
+  while (done.load() < jobs) {
+    std::this_thread::yield();
+  }
+  double const seconds{std::chrono::duration<double>(
+      Clock::now() - start).count()};
+  return done.load() / seconds;
+}
+
+static Latencies pacedPool(uint32_t jobs, double rate,
+    std::chrono::microseconds const &spin)
+{
+  Latencies latencies;
+  latencies.microseconds.reserve(jobs);
+  WorkerPool pool(1, {}, 0, spin);
+  WorkerPool::Producer producer{pool.connect(0, 1024)};
+  auto const period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / rate));
+  auto next = Clock::now();
+  for (uint32_t i = 0; i < jobs; ++i) {
+    next += period;
+    waitUntil(next);
+    auto const posted = Clock::now();
+    producer.post([&latencies, posted]() {
+        latencies.microseconds.push_back(std::chrono::duration<double,
+            std::micro>(Clock::now() - posted).count());
+      });
+  }
+  pool.drain();
+  return latencies;
+}
+
+static Latencies pacedPipeline(uint32_t jobs, double rate)
+{
+  Latencies latencies;
+  latencies.microseconds.reserve(jobs);
+  std::atomic<uint32_t> done{0};
+  {
+    cluon::NotifyingPipeline<Clock::time_point> pipeline(
+        [&latencies, &done](Clock::time_point &&posted) {
+          latencies.microseconds.push_back(std::chrono::duration<double,
+              std::micro>(Clock::now() - posted).count());
+          done++;
+        });
+    auto const period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / rate));
+    auto next = Clock::now();
+    for (uint32_t i = 0; i < jobs; ++i) {
+      next += period;
+      waitUntil(next);
+      Clock::time_point posted{Clock::now()};
+      pipeline.add(std::move(posted));
+      pipeline.notifyAll();
+    }
+    while (done.load() < jobs) {
+      std::this_thread::yield();
+    }
+  }
+  return latencies;
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+  uint32_t const jobs{(argc > 1) ?
+    static_cast<uint32_t>(std::stoul(argv[1])) : 20000};
+  double const rate{(argc > 2) ? std::stod(argv[2]) : 10000.0};
+  std::chrono::microseconds const spin{(argc > 3) ? std::stoll(argv[3]) : 0};
+
+  std::cout << "Burst of " << jobs << " jobs:" << std::endl
+    << "NotifyingPipeline: " << burstPipeline(jobs) << " jobs/s" << std::endl
+    << "WorkerPool: " << burstPool(jobs, spin) << " jobs/s" << std::endl;
+
+  std::cout << jobs << " jobs at " << rate << " Hz:" << std::endl;
+  pacedPipeline(jobs, rate).print("NotifyingPipeline");
+  pacedPool(jobs, rate, spin).print("WorkerPool");
+  return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASYNC_BLOCK_WRITER_HPP
+#define ASYNC_BLOCK_WRITER_HPP
+
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Writes blocks to a file descriptor in the background. Each block occupies a
+// slot until its write has completed, which the owner waits for before
+// reusing the memory of that slot. The writes are submitted through io_uring
+// when built with liburing and the kernel supports it, and are otherwise
+// done by one writer thread with pwrite. Either way, the rest of a block is
+// written again after a short write.
+class AsyncBlockWriter {
+ private:
+  AsyncBlockWriter(AsyncBlockWriter const &) = delete;
+  AsyncBlockWriter(AsyncBlockWriter &&) = delete;
+  AsyncBlockWriter &operator=(AsyncBlockWriter const &) = delete;
+  AsyncBlockWriter &operator=(AsyncBlockWriter &&) = delete;
+
+ public:
+  AsyncBlockWriter(int32_t fd, uint32_t slots)
+    : m_fd(fd)
+    , m_mutex()
+    , m_condition()
+    , m_jobs()
+    , m_isPending(slots, false)
+    , m_isFailed(false)
+    , m_isRunning(true)
+    , m_thread()
+#ifdef HAVE_LIBURING
+    , m_ring()
+    , m_hasRing(false)
+    , m_inFlight(slots, Job{0, nullptr, 0, 0})
+#endif
+  {
+#ifdef HAVE_LIBURING
+    m_hasRing = (0 == io_uring_queue_init(slots, &m_ring, 0));
+    if (m_hasRing) {
+      return;
+    }
+#endif
+    m_thread = std::thread([this]() { run(); });
+  }
+
+  ~AsyncBlockWriter()
+  {
+    for (uint32_t slot = 0; slot < m_isPending.size(); ++slot) {
+      wait(slot);
+    }
+#ifdef HAVE_LIBURING
+    if (m_hasRing) {
+      io_uring_queue_exit(&m_ring);
+    }
+#endif
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_isRunning = false;
+    }
+    m_condition.notify_all();
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+  // The block must stay untouched until wait() for its slot has returned.
+  void submit(uint32_t slot, char const *data, size_t len, uint64_t offset)
+  {
+#ifdef HAVE_LIBURING
+    if (m_hasRing) {
+      m_inFlight[slot] = Job{slot, data, len, offset};
+      m_isPending[slot] = true;
+      submitToRing(slot);
+      return;
+    }
+#endif
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_isPending[slot] = true;
+      m_jobs.push_back(Job{slot, data, len, offset});
+    }
+    m_condition.notify_all();
+  }
+
+  // Blocks until the write of the given slot has completed; returns false
+  // once any write has failed.
+  bool wait(uint32_t slot)
+  {
+#ifdef HAVE_LIBURING
+    if (m_hasRing) {
+      while (m_isPending[slot]) {
+        struct io_uring_cqe *cqe{nullptr};
+        if (0 != io_uring_wait_cqe(&m_ring, &cqe)) {
+          m_isFailed = true;
+          break;
+        }
+        uint32_t const completed = static_cast<uint32_t>(
+            reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+        int32_t const res{cqe->res};
+        io_uring_cqe_seen(&m_ring, cqe);
+        onCompletion(completed, res);
+      }
+      return !m_isFailed;
+    }
+#endif
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [this, slot]() { return !m_isPending[slot]; });
+    return !m_isFailed;
+  }
+
+ private:
+  struct Job {
+    uint32_t slot;
+    char const *data;
+    size_t len;
+    uint64_t offset;
+  };
+
+#ifdef HAVE_LIBURING
+  void submitToRing(uint32_t slot)
+  {
+    Job const &job = m_inFlight[slot];
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+    if (nullptr == sqe) {
+      m_isPending[slot] = false;
+      m_isFailed = true;
+      return;
+    }
+    io_uring_prep_write(sqe, m_fd, job.data, static_cast<unsigned>(job.len),
+        job.offset);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(
+          static_cast<uintptr_t>(slot)));
+    int32_t const res{io_uring_submit(&m_ring)};
+    if (res < 0) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not submit "
+        << "asynchronous write: " << strerror(-res) << std::endl;
+      m_isPending[slot] = false;
+      m_isFailed = true;
+    }
+  }
+
+  // Resubmits the rest of the block after a short write, like pwrite in
+  // run() would be called again.
+  void onCompletion(uint32_t slot, int32_t res)
+  {
+    Job &job = m_inFlight[slot];
+    if (-EINTR == res || -EAGAIN == res) {
+      submitToRing(slot);
+      return;
+    }
+    if (res <= 0) {
+      std::cerr << "[opendlv-device-camera-rtp]: Asynchronous write "
+        << "failed: " << ((0 == res) ? "no progress" : strerror(-res))
+        << std::endl;
+      m_isFailed = true;
+      m_isPending[slot] = false;
+      return;
+    }
+    size_t const n{static_cast<size_t>(res)};
+    if (n < job.len) {
+      job.data += n;
+      job.len -= n;
+      job.offset += n;
+      submitToRing(slot);
+      return;
+    }
+    m_isPending[slot] = false;
+  }
+#endif
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_condition.wait(lock, [this]() {
+          return !m_isRunning || !m_jobs.empty();
+        });
+      if (m_jobs.empty()) {
+        return;
+      }
+      Job job = m_jobs.front();
+      m_jobs.pop_front();
+      lock.unlock();
+
+      bool isFailed{false};
+      while (job.len > 0) {
+        ssize_t const n = ::pwrite(m_fd, job.data, job.len,
+            static_cast<off_t>(job.offset));
+        if (n <= 0) {
+          if (n < 0 && EINTR == errno) {
+            continue;
+          }
+          std::cerr << "[opendlv-device-camera-rtp]: Asynchronous write "
+            << "failed: " << ((0 == n) ? "no progress" : strerror(errno))
+            << std::endl;
+          isFailed = true;
+          break;
+        }
+        job.data += n;
+        job.len -= static_cast<size_t>(n);
+        job.offset += static_cast<uint64_t>(n);
+      }
+
+      lock.lock();
+      m_isFailed = m_isFailed || isFailed;
+      m_isPending[job.slot] = false;
+      m_condition.notify_all();
+    }
+  }
+
+  int32_t const m_fd;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<Job> m_jobs;
+  std::vector<bool> m_isPending;
+  bool m_isFailed;
+  bool m_isRunning;
+  std::thread m_thread;
+#ifdef HAVE_LIBURING
+  struct io_uring m_ring;
+  bool m_hasRing;
+  std::vector<Job> m_inFlight;
+#endif
+};
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENVELOPE_ENCODER_HPP
+#define ENVELOPE_ENCODER_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+namespace detail {
+
+// Appends v as a Protobuf base 128 varint.
+inline void appendVarInt(std::string &out, uint64_t v)
+{
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+// The number of bytes of v as a varint.
+inline uint32_t varIntLength(uint64_t v)
+{
+  uint32_t len = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    len++;
+  }
+  return len;
+}
+
+}
+
+// Produces the bytes that cluon::serializeEnvelope would write in front of
+// and behind the data of an ImageReading, so that a frame can be written as
+// head, data and tail with writev straight from the frame buffer instead of
+// being copied into the ImageReading, the Proto encoding, the Envelope and
+// the serialized Envelope in turn.
+//
+// cluon encodes every field, so the messages are encoded with empty data and
+// the zero length of the (last) data field of the ImageReading, and of the
+// serializedData field (id 2, right after dataType) of the Envelope, is
+// replaced by the real one. Returns false if the encoding does not look as
+// expected; the caller should then use cluon::serializeEnvelope.
+inline bool encodeImageReadingEnvelope(std::string const &fourcc,
+    uint32_t width, uint32_t height, uint64_t dataSize,
+    cluon::data::TimeStamp const &sent,
+    cluon::data::TimeStamp const &sampleTimeStamp, uint32_t senderStamp,
+    std::string &head, std::string &tail)
+{
+  constexpr char DATA_KEY{0x22}; // Field 4, length delimited.
+  constexpr char SERIALIZED_DATA_KEY{0x12}; // Field 2, length delimited.
+
+  opendlv::proxy::ImageReading ir;
+  ir.fourcc(fourcc).width(width).height(height);
+  std::string irHead;
+  {
+    cluon::ToProtoVisitor protoEncoder;
+    ir.accept(protoEncoder);
+    irHead = protoEncoder.encodedData();
+  }
+  if (irHead.size() < 2 || irHead[irHead.size() - 2] != DATA_KEY
+      || irHead[irHead.size() - 1] != 0x00) {
+    return false;
+  }
+  irHead.pop_back();
+  detail::appendVarInt(irHead, dataSize);
+  uint64_t const irSize{irHead.size() + dataSize};
+
+  cluon::data::Envelope envelope;
+  envelope.dataType(ir.ID());
+  envelope.sent(sent);
+  envelope.sampleTimeStamp(sampleTimeStamp);
+  envelope.senderStamp(senderStamp);
+  std::string encodedEnvelope;
+  {
+    cluon::ToProtoVisitor protoEncoder;
+    envelope.accept(protoEncoder);
+    encodedEnvelope = protoEncoder.encodedData();
+  }
+  // Key and zigzag encoded dataType come first.
+  int32_t const dataType{ir.ID()};
+  uint32_t const dataTypeSize{1 + detail::varIntLength(
+      static_cast<uint32_t>((dataType << 1) ^ (dataType >> 31)))};
+  if (encodedEnvelope.size() < dataTypeSize + 2
+      || encodedEnvelope[dataTypeSize] != SERIALIZED_DATA_KEY
+      || encodedEnvelope[dataTypeSize + 1] != 0x00) {
+    return false;
+  }
+  std::string envelopeHead{encodedEnvelope.substr(0, dataTypeSize + 1)};
+  detail::appendVarInt(envelopeHead, irSize);
+  tail = encodedEnvelope.substr(dataTypeSize + 2);
+
+  uint64_t const envelopeSize{envelopeHead.size() + irSize + tail.size()};
+  if (envelopeSize > 0xffffff) {
+    // The OD4 header only has room for 24 bits of length.
+    return false;
+  }
+
+  head.clear();
+  head.reserve(5 + envelopeHead.size() + irHead.size());
+  head.push_back(static_cast<char>(0x0D));
+  head.push_back(static_cast<char>(0xA4));
+  head.push_back(static_cast<char>(envelopeSize & 0xff));
+  head.push_back(static_cast<char>((envelopeSize >> 8) & 0xff));
+  head.push_back(static_cast<char>((envelopeSize >> 16) & 0xff));
+  head += envelopeHead;
+  head += irHead;
+  return true;
+}
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENT_LOOP_HPP
+#define EVENT_LOOP_HPP
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// One thread waiting in epoll_wait for any of its file descriptors, without
+// a timeout: it only wakes up for data and for being stopped (eventfd).
+// Handlers run on the loop's thread, which inherits the CPU affinity and
+// scheduling of the thread calling start().
+//
+// With a spin time, the loop busy polls (epoll_wait without blocking) for
+// that long after the last event before it goes back to sleeping, which
+// saves the wakeup latency while data flows but occupies a whole core; it is
+// meant for a thread pinned to a core of its own.
+class EventLoop {
+ private:
+  EventLoop(EventLoop const &) = delete;
+  EventLoop(EventLoop &&) = delete;
+  EventLoop &operator=(EventLoop const &) = delete;
+  EventLoop &operator=(EventLoop &&) = delete;
+
+ public:
+  explicit EventLoop(std::chrono::microseconds const &spinTime)
+    : m_spinTime(spinTime)
+    , m_epollFd(::epoll_create1(EPOLL_CLOEXEC))
+    , m_stopFd(::eventfd(0, EFD_CLOEXEC))
+    , m_handlers()
+    , m_thread()
+  {
+    if (-1 == m_epollFd || -1 == m_stopFd) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not create event loop: "
+        << strerror(errno) << std::endl;
+      return;
+    }
+    add(m_stopFd, nullptr);
+  }
+
+  ~EventLoop()
+  {
+    stop();
+    if (-1 != m_stopFd) {
+      ::close(m_stopFd);
+    }
+    if (-1 != m_epollFd) {
+      ::close(m_epollFd);
+    }
+  }
+
+  // Calls the handler whenever the file descriptor is readable; the handler
+  // has to consume what is there.
+  bool add(int32_t fd, std::function<void()> &&handler)
+  {
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = static_cast<uint32_t>(m_handlers.size());
+    if (0 != ::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event)) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not add file "
+        << "descriptor " << fd << " to event loop: " << strerror(errno)
+        << std::endl;
+      return false;
+    }
+    m_handlers.push_back(std::move(handler));
+    return true;
+  }
+
+  void start()
+  {
+    m_thread = std::thread([this]() { run(); });
+  }
+
+  void stop()
+  {
+    if (m_thread.joinable()) {
+      uint64_t const one{1};
+      if (static_cast<ssize_t>(sizeof(one))
+          != ::write(m_stopFd, &one, sizeof(one))) {
+        std::cerr << "[opendlv-device-camera-rtp]: Could not stop event loop."
+          << std::endl;
+      }
+      m_thread.join();
+    }
+  }
+
+ private:
+  static constexpr int32_t MAX_EVENTS{8};
+
+  void run()
+  {
+    struct epoll_event events[MAX_EVENTS];
+    auto lastEvent = std::chrono::steady_clock::now();
+    while (true) {
+      bool const isSpinning{m_spinTime.count() > 0
+        && std::chrono::steady_clock::now() - lastEvent < m_spinTime};
+      int32_t const count{::epoll_wait(m_epollFd, events, MAX_EVENTS,
+          isSpinning ? 0 : -1)};
+      if (count < 0) {
+        if (EINTR == errno) {
+          continue;
+        }
+        std::cerr << "[opendlv-device-camera-rtp]: epoll_wait failed: "
+          << strerror(errno) << std::endl;
+        return;
+      }
+      if (count > 0 && m_spinTime.count() > 0) {
+        lastEvent = std::chrono::steady_clock::now();
+      }
+      for (int32_t i = 0; i < count; ++i) {
+        std::function<void()> const &handler{m_handlers[events[i].data.u32]};
+        if (!handler) {
+          // The stop event.
+          return;
+        }
+        handler();
+      }
+    }
+  }
+
+  std::chrono::microseconds const m_spinTime;
+  int32_t m_epollFd;
+  int32_t m_stopFd;
+  std::vector<std::function<void()>> m_handlers;
+  std::thread m_thread;
+};
+
+#endif
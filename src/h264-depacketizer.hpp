@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H264_DEPACKETIZER_HPP
+#define H264_DEPACKETIZER_HPP
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Reassembles H.264 access units from RTP payloads as described in RFC 6184:
+// single NAL unit packets, single-time aggregation packets (STAP-A) and
+// fragmentation units (FU-A). An access unit ends with the RTP marker bit, or
+// with the next timestamp if the packet carrying the marker was lost.
+//
+// The delegate receives each access unit in Annex B byte stream format,
+// together with the SPS and PPS it carries, so that those can still be handed
+// to the decoder when the access unit itself is dropped. Each of the
+// out-of-band SPS and PPS (sprop-parameter-sets) is put in front of every IDR
+// picture that does not carry its own of that type.
+class H264Depacketizer {
+ private:
+  H264Depacketizer(H264Depacketizer const &) = delete;
+  H264Depacketizer(H264Depacketizer &&) = delete;
+  H264Depacketizer &operator=(H264Depacketizer const &) = delete;
+  H264Depacketizer &operator=(H264Depacketizer &&) = delete;
+
+ public:
+  using Delegate = std::function<void(std::string &&, uint32_t, bool, bool,
+      std::string &&)>;
+
+  H264Depacketizer(std::string const &sps, std::string const &pps,
+      Delegate &&delegate)
+    : m_parameterSets()
+    , m_delegate(std::move(delegate))
+    , m_nalUnits()
+    , m_fragment()
+    , m_timestamp(0)
+    , m_isInFragment(false)
+  {
+    std::array<std::string const *, 2> const parameterSets{{&sps, &pps}};
+    for (uint32_t i = 0; i < parameterSets.size(); ++i) {
+      if (!parameterSets[i]->empty()) {
+        m_parameterSets[i] = startCode() + *parameterSets[i];
+      }
+    }
+  }
+
+  void push(uint8_t const *payload, size_t length, uint32_t timestamp,
+      bool isMarker)
+  {
+    if (!m_nalUnits.empty() && timestamp != m_timestamp) {
+      emit();
+    }
+    m_timestamp = timestamp;
+
+    if (length < 2) {
+      return;
+    }
+    uint8_t const type = payload[0] & 0x1f;
+    if (0 != (payload[0] & 0x80)) {
+      // The forbidden zero bit marks a damaged NAL unit.
+      return;
+    } else if (STAP_A == type) {
+      onAggregationPacket(payload, length);
+    } else if (FU_A == type) {
+      onFragmentationUnit(payload, length);
+    } else if (type >= 1 && type <= 23) {
+      m_nalUnits.emplace_back(reinterpret_cast<char const *>(payload),
+          length);
+    }
+
+    if (isMarker) {
+      emit();
+    }
+  }
+
+ private:
+  static constexpr uint8_t IDR{5};
+  static constexpr uint8_t SPS{7};
+  static constexpr uint8_t PPS{8};
+  static constexpr uint8_t ACCESS_UNIT_DELIMITER{9};
+  static constexpr uint8_t STAP_A{24};
+  static constexpr uint8_t FU_A{28};
+
+  static uint8_t typeOf(std::string const &nal)
+  {
+    return static_cast<uint8_t>(nal[0]) & 0x1f;
+  }
+
+  static std::string startCode()
+  {
+    return std::string("\x00\x00\x00\x01", 4);
+  }
+
+  void onAggregationPacket(uint8_t const *payload, size_t length)
+  {
+    size_t offset{1};
+    while (offset + 2 <= length) {
+      size_t const size{static_cast<size_t>((payload[offset] << 8)
+          | payload[offset + 1])};
+      offset += 2;
+      if (0 == size || offset + size > length) {
+        return;
+      }
+      m_nalUnits.emplace_back(reinterpret_cast<char const *>(payload + offset),
+          size);
+      offset += size;
+    }
+  }
+
+  void onFragmentationUnit(uint8_t const *payload, size_t length)
+  {
+    uint8_t const fuHeader{payload[1]};
+    bool const isStart{0 != (fuHeader & 0x80)};
+    bool const isEnd{0 != (fuHeader & 0x40)};
+
+    if (isStart) {
+      // The NAL unit header is the F and NRI bits of the FU indicator with
+      // the type of the FU header.
+      m_fragment.assign(1, static_cast<char>((payload[0] & 0xe0)
+            | (fuHeader & 0x1f)));
+      m_isInFragment = true;
+    } else if (!m_isInFragment) {
+      // The start of this NAL unit was lost.
+      return;
+    }
+    m_fragment.append(reinterpret_cast<char const *>(payload + 2),
+        length - 2);
+    if (isEnd) {
+      m_nalUnits.push_back(std::move(m_fragment));
+      m_fragment = std::string();
+      m_isInFragment = false;
+    }
+  }
+
+  void emit()
+  {
+    if (m_nalUnits.empty()) {
+      return;
+    }
+
+    // The SPS and PPS carried, by type.
+    std::array<std::string, 2> carried;
+    bool hasIdr{false};
+    bool hasPicture{false};
+    bool isReference{false};
+    size_t size{0};
+    for (auto const &nalUnit : m_nalUnits) {
+      uint8_t const type{typeOf(nalUnit)};
+      if (SPS == type || PPS == type) {
+        carried[type - SPS] += startCode() + nalUnit;
+      }
+      // Slices are the types 1 to 5; a nal_ref_idc of zero marks a picture
+      // no other one refers to.
+      if (type >= 1 && type <= IDR) {
+        hasPicture = true;
+        hasIdr |= (IDR == type);
+        isReference |= (0 != (nalUnit[0] & 0x60));
+      }
+      size += 4 + nalUnit.size();
+    }
+
+    // An IDR picture gets the out-of-band sets of the types it lacks. They
+    // are then merged with the carried ones, the SPS first as the PPS refers
+    // to it.
+    bool isMissing{false};
+    std::string parameterSets;
+    for (uint32_t i = 0; i < carried.size(); ++i) {
+      if (hasIdr && carried[i].empty() && !m_parameterSets[i].empty()) {
+        parameterSets += m_parameterSets[i];
+        isMissing = true;
+      } else {
+        parameterSets += carried[i];
+      }
+    }
+
+    std::string accessUnit;
+    accessUnit.reserve(size + parameterSets.size());
+    // The parameter sets go after the access unit delimiter, if any.
+    size_t first{0};
+    if (ACCESS_UNIT_DELIMITER == typeOf(m_nalUnits.front())) {
+      accessUnit += startCode() + m_nalUnits.front();
+      first = 1;
+    }
+    if (isMissing) {
+      accessUnit += parameterSets;
+    }
+    for (size_t i = first; i < m_nalUnits.size(); ++i) {
+      uint8_t const type{typeOf(m_nalUnits[i])};
+      if (isMissing && (SPS == type || PPS == type)) {
+        continue;
+      }
+      accessUnit += startCode();
+      accessUnit += m_nalUnits[i];
+    }
+    m_nalUnits.clear();
+
+    m_delegate(std::move(accessUnit), m_timestamp,
+        hasIdr || !carried[0].empty(),
+        isReference || !hasPicture, std::move(parameterSets));
+  }
+
+  // The out-of-band SPS and PPS, each with its start code.
+  std::array<std::string, 2> m_parameterSets;
+  Delegate m_delegate;
+  std::vector<std::string> m_nalUnits;
+  std::string m_fragment;
+  uint32_t m_timestamp;
+  bool m_isInFragment;
+};
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEVC_DEPACKETIZER_HPP
+#define HEVC_DEPACKETIZER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Reassembles H.265 access units from RTP payloads as described in RFC 7798:
+// single NAL unit packets, aggregation packets (type 48) and fragmentation
+// units (type 49). When the session signals sprop-max-don-diff > 0, every NAL
+// unit carries a decoding order number (DONL, or DOND relative to the previous
+// one in an aggregation packet); the NAL units of an access unit are then put
+// back into decoding order. An access unit ends with the RTP marker bit, or
+// with the next timestamp if the packet carrying the marker was lost.
+//
+// The delegate receives each access unit in Annex B byte stream format,
+// together with the VPS, SPS and PPS it carries, so that those can still be
+// handed to the decoder when the access unit itself is dropped. Each of the
+// out-of-band VPS, SPS and PPS (sprop-vps/sps/pps) is put in front of every
+// IRAP picture that does not carry its own of that type.
+class HevcDepacketizer {
+ private:
+  HevcDepacketizer(HevcDepacketizer const &) = delete;
+  HevcDepacketizer(HevcDepacketizer &&) = delete;
+  HevcDepacketizer &operator=(HevcDepacketizer const &) = delete;
+  HevcDepacketizer &operator=(HevcDepacketizer &&) = delete;
+
+ public:
+  using Delegate = std::function<void(std::string &&, uint32_t, bool, bool,
+      std::string &&)>;
+
+  HevcDepacketizer(std::string const &vps, std::string const &sps,
+      std::string const &pps, bool hasDon, Delegate &&delegate)
+    : m_parameterSets()
+    , m_hasDon(hasDon)
+    , m_delegate(std::move(delegate))
+    , m_nalUnits()
+    , m_fragment()
+    , m_fragmentDon(0)
+    , m_timestamp(0)
+    , m_nextDon(0)
+    , m_isInFragment(false)
+  {
+    std::array<std::string const *, 3> const parameterSets{{&vps, &sps,
+      &pps}};
+    for (uint32_t i = 0; i < parameterSets.size(); ++i) {
+      if (!parameterSets[i]->empty()) {
+        m_parameterSets[i] = startCode() + *parameterSets[i];
+      }
+    }
+  }
+
+  void push(uint8_t const *payload, size_t length, uint32_t timestamp,
+      bool isMarker)
+  {
+    if (!m_nalUnits.empty() && timestamp != m_timestamp) {
+      emit();
+    }
+    m_timestamp = timestamp;
+
+    if (length < 3) {
+      return;
+    }
+    uint8_t const type = (payload[0] >> 1) & 0x3f;
+    if (AGGREGATION_PACKET == type) {
+      onAggregationPacket(payload, length);
+    } else if (FRAGMENTATION_UNIT == type) {
+      onFragmentationUnit(payload, length);
+    } else if (type < AGGREGATION_PACKET) {
+      size_t offset{2};
+      uint16_t don{m_nextDon};
+      if (m_hasDon) {
+        if (length < 4) {
+          return;
+        }
+        don = static_cast<uint16_t>((payload[2] << 8) | payload[3]);
+        offset += 2;
+      }
+      if (length > offset) {
+        std::string nal(reinterpret_cast<char const *>(payload), 2);
+        nal.append(reinterpret_cast<char const *>(payload + offset),
+            length - offset);
+        add(don, std::move(nal));
+      }
+    }
+
+    if (isMarker) {
+      emit();
+    }
+  }
+
+ private:
+  static constexpr uint8_t AGGREGATION_PACKET{48};
+  static constexpr uint8_t FRAGMENTATION_UNIT{49};
+  static constexpr uint8_t VPS{32};
+  static constexpr uint8_t PPS{34};
+  static constexpr uint8_t ACCESS_UNIT_DELIMITER{35};
+
+  static uint8_t typeOf(std::string const &nal)
+  {
+    return (static_cast<uint8_t>(nal[0]) >> 1) & 0x3f;
+  }
+
+  static std::string startCode()
+  {
+    return std::string("\x00\x00\x00\x01", 4);
+  }
+
+  void onAggregationPacket(uint8_t const *payload, size_t length)
+  {
+    size_t offset{2};
+    uint16_t don{m_nextDon};
+    bool isFirst{true};
+    while (offset < length) {
+      if (m_hasDon) {
+        if (isFirst) {
+          if (offset + 2 > length) {
+            return;
+          }
+          don = static_cast<uint16_t>((payload[offset] << 8)
+              | payload[offset + 1]);
+          offset += 2;
+        } else {
+          // DOND is the difference to the previous NAL unit minus one.
+          don = static_cast<uint16_t>(don + payload[offset] + 1);
+          offset += 1;
+        }
+      }
+      if (offset + 2 > length) {
+        return;
+      }
+      size_t const size{static_cast<size_t>((payload[offset] << 8)
+          | payload[offset + 1])};
+      offset += 2;
+      if (0 == size || offset + size > length) {
+        return;
+      }
+      add(don, std::string(reinterpret_cast<char const *>(payload + offset),
+            size));
+      offset += size;
+      don = m_hasDon ? don : m_nextDon;
+      isFirst = false;
+    }
+  }
+
+  void onFragmentationUnit(uint8_t const *payload, size_t length)
+  {
+    uint8_t const fuHeader{payload[2]};
+    bool const isStart{0 != (fuHeader & 0x80)};
+    bool const isEnd{0 != (fuHeader & 0x40)};
+    size_t offset{3};
+
+    if (isStart) {
+      m_fragmentDon = m_nextDon;
+      if (m_hasDon) {
+        if (length < 5) {
+          return;
+        }
+        m_fragmentDon = static_cast<uint16_t>((payload[3] << 8) | payload[4]);
+        offset += 2;
+      }
+      // The NAL unit header is the payload header with the type of the FU
+      // header.
+      m_fragment.clear();
+      m_fragment.push_back(static_cast<char>((payload[0] & 0x81)
+            | ((fuHeader & 0x3f) << 1)));
+      m_fragment.push_back(static_cast<char>(payload[1]));
+      m_isInFragment = true;
+    } else if (!m_isInFragment) {
+      // The start of this NAL unit was lost.
+      return;
+    }
+    if (length > offset) {
+      m_fragment.append(reinterpret_cast<char const *>(payload + offset),
+          length - offset);
+    }
+    if (isEnd) {
+      add(m_fragmentDon, std::move(m_fragment));
+      m_fragment = std::string();
+      m_isInFragment = false;
+    }
+  }
+
+  void add(uint16_t don, std::string &&nal)
+  {
+    m_nalUnits.emplace_back(don, std::move(nal));
+    m_nextDon = static_cast<uint16_t>(don + 1);
+  }
+
+  void emit()
+  {
+    if (m_nalUnits.empty()) {
+      return;
+    }
+    if (m_hasDon) {
+      uint16_t const firstDon{m_nalUnits.front().first};
+      std::stable_sort(m_nalUnits.begin(), m_nalUnits.end(),
+          [firstDon](std::pair<uint16_t, std::string> const &a,
+            std::pair<uint16_t, std::string> const &b) {
+            return static_cast<int16_t>(a.first - firstDon)
+              < static_cast<int16_t>(b.first - firstDon);
+          });
+    }
+
+    // The VPS, SPS and PPS carried, by type.
+    std::array<std::string, 3> carried;
+    bool hasPicture{false};
+    bool isKeyframe{false};
+    bool isReference{false};
+    size_t size{0};
+    for (auto const &nalUnit : m_nalUnits) {
+      uint8_t const type{typeOf(nalUnit.second)};
+      if (type >= VPS && type <= PPS) {
+        carried[type - VPS] += startCode() + nalUnit.second;
+      }
+      // IRAP pictures are the types 16 to 23; the even types below 16 are
+      // sub-layer non-reference pictures.
+      if (type < VPS) {
+        hasPicture = true;
+        isKeyframe |= (type >= 16 && type <= 23);
+        isReference |= (type >= 16 || 1 == (type & 1));
+      }
+      size += 4 + nalUnit.second.size();
+    }
+
+    // An IRAP picture gets the out-of-band sets of the types it lacks. They
+    // are then merged with the carried ones in the order VPS, SPS, PPS, in
+    // which they refer to each other.
+    bool isMissing{false};
+    std::string parameterSets;
+    for (uint32_t i = 0; i < carried.size(); ++i) {
+      if (isKeyframe && carried[i].empty() && !m_parameterSets[i].empty()) {
+        parameterSets += m_parameterSets[i];
+        isMissing = true;
+      } else {
+        parameterSets += carried[i];
+      }
+    }
+
+    std::string accessUnit;
+    accessUnit.reserve(size + parameterSets.size());
+    // The parameter sets go after the access unit delimiter, if any.
+    size_t first{0};
+    if (ACCESS_UNIT_DELIMITER == typeOf(m_nalUnits.front().second)) {
+      accessUnit += startCode() + m_nalUnits.front().second;
+      first = 1;
+    }
+    if (isMissing) {
+      accessUnit += parameterSets;
+    }
+    for (size_t i = first; i < m_nalUnits.size(); ++i) {
+      uint8_t const type{typeOf(m_nalUnits[i].second)};
+      if (isMissing && type >= VPS && type <= PPS) {
+        continue;
+      }
+      accessUnit += startCode();
+      accessUnit += m_nalUnits[i].second;
+    }
+    m_nalUnits.clear();
+
+    m_delegate(std::move(accessUnit), m_timestamp, isKeyframe,
+        isReference || !hasPicture, std::move(parameterSets));
+  }
+
+  // The out-of-band VPS, SPS and PPS, each with its start code.
+  std::array<std::string, 3> m_parameterSets;
+  bool const m_hasDon;
+  Delegate m_delegate;
+  std::vector<std::pair<uint16_t, std::string>> m_nalUnits;
+  std::string m_fragment;
+  uint16_t m_fragmentDon;
+  uint32_t m_timestamp;
+  uint16_t m_nextDon;
+  bool m_isInFragment;
+};
+
+#endif
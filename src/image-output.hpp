@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_OUTPUT_HPP
+#define IMAGE_OUTPUT_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <libyuv.h>
+
+#include "cluon-complete.hpp"
+
+// The names give the byte order in memory: RGB24 is R, G, B and BGR24 is
+// B, G, R (which libyuv calls RAW and RGB24). Planar RGB is a full plane of
+// R followed by the planes of G and B. NV12 is the Y plane followed by one
+// plane of interleaved U and V.
+enum class PixelFormat {
+  ARGB,
+  I420,
+  NV12,
+  RGB24,
+  BGR24,
+  PLANAR_RGB
+};
+
+inline std::string toString(PixelFormat format)
+{
+  switch (format) {
+    case PixelFormat::I420: return "i420";
+    case PixelFormat::NV12: return "nv12";
+    case PixelFormat::RGB24: return "rgb24";
+    case PixelFormat::BGR24: return "bgr24";
+    case PixelFormat::PLANAR_RGB: return "rgbp";
+    default: return "argb";
+  }
+}
+
+inline bool parsePixelFormat(std::string const &text, PixelFormat &format)
+{
+  for (PixelFormat candidate : {PixelFormat::ARGB, PixelFormat::I420,
+      PixelFormat::NV12, PixelFormat::RGB24, PixelFormat::BGR24,
+      PixelFormat::PLANAR_RGB}) {
+    if (toString(candidate) == text) {
+      format = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint32_t imageSize(PixelFormat format, uint32_t width, uint32_t height)
+{
+  uint32_t const chromaSize{((width + 1) / 2) * ((height + 1) / 2)};
+  switch (format) {
+    case PixelFormat::I420:
+    case PixelFormat::NV12:
+      return width * height + 2 * chromaSize;
+    case PixelFormat::RGB24:
+    case PixelFormat::BGR24:
+    case PixelFormat::PLANAR_RGB:
+      return width * height * 3;
+    default:
+      return width * height * 4;
+  }
+}
+
+// Lets frames through at no more than the given rate (in Hz) according to
+// their media time, or every frame for a rate of 0. The frames let through
+// keep to a grid of periods while they flow, so that e.g. 7 Hz out of 30 fps
+// averages 7 Hz; after a gap the grid starts over.
+class Decimator {
+ public:
+  explicit Decimator(double rate)
+    : m_period(rate > 0.0 ? static_cast<int64_t>(1000000.0 / rate) : 0)
+    , m_next(0)
+    , m_isStarted(false)
+  {
+  }
+
+  bool isDue(int64_t timeInMicroseconds)
+  {
+    if (0 == m_period) {
+      return true;
+    }
+    if (m_isStarted && timeInMicroseconds < m_next) {
+      return false;
+    }
+    m_next = (m_isStarted && timeInMicroseconds < m_next + m_period)
+      ? m_next + m_period : timeInMicroseconds + m_period;
+    m_isStarted = true;
+    return true;
+  }
+
+ private:
+  int64_t m_period;
+  int64_t m_next;
+  bool m_isStarted;
+};
+
+// An additional image output, e.g. "640x360:argb", or "nv12" for the size of
+// the decoded image (a width and height of 0). The output may be cut from a
+// region of the decoded image (a crop width and height of 0 for all of it),
+// and may be limited to a rate, e.g. "640x360:argb@5" (0 for every frame).
+struct OutputSpec {
+  uint32_t width;
+  uint32_t height;
+  PixelFormat format;
+  uint32_t cropX;
+  uint32_t cropY;
+  uint32_t cropWidth;
+  uint32_t cropHeight;
+  double rate;
+};
+
+// Takes the rate off the end of an output, "<output>@<rate>".
+inline bool parseRate(std::string &text, double &rate)
+{
+  rate = 0.0;
+  size_t const at{text.find('@')};
+  if (std::string::npos == at) {
+    return true;
+  }
+  try {
+    rate = std::stod(text.substr(at + 1));
+  } catch (std::exception const &) {
+    return false;
+  }
+  text = text.substr(0, at);
+  return rate > 0.0;
+}
+
+inline bool parseOutputSpec(std::string text, OutputSpec &spec)
+{
+  if (!parseRate(text, spec.rate)) {
+    return false;
+  }
+  spec.cropX = 0;
+  spec.cropY = 0;
+  spec.cropWidth = 0;
+  spec.cropHeight = 0;
+  size_t const colon{text.find(':')};
+  if (std::string::npos == colon) {
+    spec.width = 0;
+    spec.height = 0;
+    return parsePixelFormat(text, spec.format);
+  }
+  size_t const x{text.find('x')};
+  if (std::string::npos == x || colon < x
+      || !parsePixelFormat(text.substr(colon + 1), spec.format)) {
+    return false;
+  }
+  try {
+    spec.width = static_cast<uint32_t>(std::stoi(text.substr(0, x)));
+    spec.height = static_cast<uint32_t>(std::stoi(text.substr(x + 1,
+            colon - x - 1)));
+  } catch (std::exception const &) {
+    return false;
+  }
+  return 0 < spec.width && 0 < spec.height;
+}
+
+// A region of interest, "x,y,w,h" with an optional ":<format>" (ARGB by
+// default) and "@<rate>", output in its own size.
+inline bool parseRoiSpec(std::string text, OutputSpec &spec)
+{
+  if (!parseRate(text, spec.rate)) {
+    return false;
+  }
+  size_t const colon{text.find(':')};
+  spec.format = PixelFormat::ARGB;
+  if (std::string::npos != colon
+      && !parsePixelFormat(text.substr(colon + 1), spec.format)) {
+    return false;
+  }
+  std::istringstream fields(text.substr(0, colon));
+  uint32_t values[4];
+  for (uint32_t &value : values) {
+    std::string field;
+    if (!std::getline(fields, field, ',')) {
+      return false;
+    }
+    try {
+      value = static_cast<uint32_t>(std::stoul(field));
+    } catch (std::exception const &) {
+      return false;
+    }
+  }
+  spec.cropX = values[0];
+  spec.cropY = values[1];
+  spec.cropWidth = values[2];
+  spec.cropHeight = values[3];
+  spec.width = 0;
+  spec.height = 0;
+  return 0 < spec.cropWidth && 0 < spec.cropHeight;
+}
+
+// One shared memory segment filled from the decoded I420 image, or a region
+// of it, scaled with libyuv to the size of the output if it differs and
+// converted to the pixel format of the output. Only the region is read, so
+// the memory traffic of a cut out output shrinks with its area. The region
+// starts at even coordinates to keep the chroma planes aligned, and is
+// clipped to the image. Scaling and conversion happen
+// outside the lock of the shared memory where the conversion needs an
+// intermediate image, so that consumers are only blocked for the final pass.
+//
+// write() is not thread safe; each output is meant to be written from a
+// single worker.
+class ImageOutput {
+ private:
+  ImageOutput(ImageOutput const &) = delete;
+  ImageOutput(ImageOutput &&) = delete;
+  ImageOutput &operator=(ImageOutput const &) = delete;
+  ImageOutput &operator=(ImageOutput &&) = delete;
+
+ public:
+  ImageOutput(std::string const &name, OutputSpec const &spec,
+      uint32_t sourceWidth, uint32_t sourceHeight)
+    : m_spec(spec)
+    , m_sourceWidth(sourceWidth)
+    , m_sourceHeight(sourceHeight)
+    , m_decimator(spec.rate)
+    , m_sharedMemory(nullptr)
+    , m_scaled()
+    , m_rgb()
+  {
+    if (0 == m_spec.cropWidth || 0 == m_spec.cropHeight) {
+      m_spec.cropX = 0;
+      m_spec.cropY = 0;
+      m_spec.cropWidth = sourceWidth;
+      m_spec.cropHeight = sourceHeight;
+    }
+    m_spec.cropX = std::min(m_spec.cropX & ~1U, sourceWidth & ~1U);
+    m_spec.cropY = std::min(m_spec.cropY & ~1U, sourceHeight & ~1U);
+    m_spec.cropWidth = std::min(m_spec.cropWidth, sourceWidth - m_spec.cropX);
+    m_spec.cropHeight = std::min(m_spec.cropHeight,
+        sourceHeight - m_spec.cropY);
+    if (0 == m_spec.cropWidth || 0 == m_spec.cropHeight) {
+      std::cerr << "[opendlv-device-camera-rtp]: The region of " << name
+        << " is outside the image, using all of it." << std::endl;
+      m_spec.cropX = 0;
+      m_spec.cropY = 0;
+      m_spec.cropWidth = sourceWidth;
+      m_spec.cropHeight = sourceHeight;
+    }
+    m_sourceWidth = m_spec.cropWidth;
+    m_sourceHeight = m_spec.cropHeight;
+    if (0 == m_spec.width || 0 == m_spec.height) {
+      m_spec.width = m_sourceWidth;
+      m_spec.height = m_sourceHeight;
+    }
+
+    uint32_t const size{imageSize(m_spec.format, m_spec.width,
+        m_spec.height)};
+    std::clog << "[opendlv-device-camera-rtp]: Created shared memory " << name
+      << " (" << size << " bytes) for an image in " << toString(m_spec.format)
+      << " (width = " << m_spec.width << ", height = " << m_spec.height
+      << ")." << std::endl;
+    m_sharedMemory.reset(new cluon::SharedMemory{name, size});
+    if (isScaling() && PixelFormat::I420 != m_spec.format) {
+      m_scaled.resize(imageSize(PixelFormat::I420, m_spec.width,
+            m_spec.height));
+    }
+    if (PixelFormat::PLANAR_RGB == m_spec.format) {
+      m_rgb.resize(imageSize(PixelFormat::RGB24, m_spec.width,
+            m_spec.height));
+    }
+  }
+
+  cluon::SharedMemory &sharedMemory()
+  {
+    return *m_sharedMemory;
+  }
+
+  // The spec with the region clipped to the image and starting at even
+  // coordinates; the region is all of the image if none was given.
+  OutputSpec const &spec() const
+  {
+    return m_spec;
+  }
+
+  // Whether the frame of the given media time is to be written, as limited
+  // by the rate of the output; to be asked once per frame.
+  bool isDue(int64_t mediaTimeInMicroseconds)
+  {
+    return m_decimator.isDue(mediaTimeInMicroseconds);
+  }
+
+  // Writes the output from the planes of the whole decoded image.
+  void write(uint8_t const *y, int32_t yStride, uint8_t const *u,
+      int32_t uStride, uint8_t const *v, int32_t vStride,
+      cluon::data::TimeStamp const &sampleTime)
+  {
+    int32_t const cropX{static_cast<int32_t>(m_spec.cropX)};
+    int32_t const cropY{static_cast<int32_t>(m_spec.cropY)};
+    writeRegion(y + cropY * yStride + cropX, yStride,
+        u + (cropY / 2) * uStride + cropX / 2, uStride,
+        v + (cropY / 2) * vStride + cropX / 2, vStride, sampleTime);
+  }
+
+  // Writes the output from planes that only hold its region.
+  void writeRegion(uint8_t const *y, int32_t yStride, uint8_t const *u,
+      int32_t uStride, uint8_t const *v, int32_t vStride,
+      cluon::data::TimeStamp const &sampleTime)
+  {
+    int32_t const width{static_cast<int32_t>(m_spec.width)};
+    int32_t const height{static_cast<int32_t>(m_spec.height)};
+    int32_t const chromaWidth{(width + 1) / 2};
+    int32_t const chromaHeight{(height + 1) / 2};
+
+    if (isScaling() && PixelFormat::I420 != m_spec.format) {
+      uint8_t *scaled = m_scaled.data();
+      scale(y, yStride, u, uStride, v, vStride, scaled, width,
+          scaled + width * height, chromaWidth,
+          scaled + width * height + chromaWidth * chromaHeight, chromaWidth);
+      y = scaled;
+      yStride = width;
+      u = scaled + width * height;
+      uStride = chromaWidth;
+      v = u + chromaWidth * chromaHeight;
+      vStride = chromaWidth;
+    }
+
+    if (PixelFormat::PLANAR_RGB == m_spec.format) {
+      libyuv::I420ToRAW(y, yStride, u, uStride, v, vStride, m_rgb.data(),
+          width * 3, width, height);
+    }
+
+    uint8_t *data = reinterpret_cast<uint8_t *>(m_sharedMemory->data());
+    m_sharedMemory->lock();
+    m_sharedMemory->setTimeStamp(sampleTime);
+    switch (m_spec.format) {
+      case PixelFormat::I420:
+        {
+          uint8_t *dstU = data + width * height;
+          uint8_t *dstV = dstU + chromaWidth * chromaHeight;
+          if (isScaling()) {
+            scale(y, yStride, u, uStride, v, vStride, data, width, dstU,
+                chromaWidth, dstV, chromaWidth);
+          } else {
+            libyuv::I420Copy(y, yStride, u, uStride, v, vStride, data, width,
+                dstU, chromaWidth, dstV, chromaWidth, width, height);
+          }
+        }
+        break;
+      case PixelFormat::NV12:
+        libyuv::I420ToNV12(y, yStride, u, uStride, v, vStride, data, width,
+            data + width * height, 2 * chromaWidth, width, height);
+        break;
+      case PixelFormat::RGB24:
+        libyuv::I420ToRAW(y, yStride, u, uStride, v, vStride, data,
+            width * 3, width, height);
+        break;
+      case PixelFormat::BGR24:
+        libyuv::I420ToRGB24(y, yStride, u, uStride, v, vStride, data,
+            width * 3, width, height);
+        break;
+      case PixelFormat::PLANAR_RGB:
+        libyuv::SplitRGBPlane(m_rgb.data(), width * 3, data, width,
+            data + width * height, width, data + 2 * width * height, width,
+            width, height);
+        break;
+      default:
+        libyuv::I420ToARGB(y, yStride, u, uStride, v, vStride, data,
+            width * 4, width, height);
+        break;
+    }
+    m_sharedMemory->unlock();
+    m_sharedMemory->notifyAll();
+  }
+
+ private:
+  bool isScaling() const
+  {
+    return m_spec.width != m_sourceWidth || m_spec.height != m_sourceHeight;
+  }
+
+  void scale(uint8_t const *y, int32_t yStride, uint8_t const *u,
+      int32_t uStride, uint8_t const *v, int32_t vStride, uint8_t *dstY,
+      int32_t dstYStride, uint8_t *dstU, int32_t dstUStride, uint8_t *dstV,
+      int32_t dstVStride)
+  {
+    // The box filter averages all source pixels of a destination pixel,
+    // which avoids aliasing when shrinking by large factors.
+    libyuv::I420Scale(y, yStride, u, uStride, v, vStride,
+        static_cast<int32_t>(m_sourceWidth),
+        static_cast<int32_t>(m_sourceHeight), dstY, dstYStride, dstU,
+        dstUStride, dstV, dstVStride, static_cast<int32_t>(m_spec.width),
+        static_cast<int32_t>(m_spec.height), libyuv::kFilterBox);
+  }
+
+  OutputSpec m_spec;
+  uint32_t m_sourceWidth;
+  uint32_t m_sourceHeight;
+  Decimator m_decimator;
+  std::unique_ptr<cluon::SharedMemory> m_sharedMemory;
+  std::vector<uint8_t> m_scaled;
+  std::vector<uint8_t> m_rgb;
+};
+
+#endif
@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MJPEG_DEPACKETIZER_HPP
+#define MJPEG_DEPACKETIZER_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+
+// Reassembles JPEG images from RTP payloads as described in RFC 2435. The
+// payload only carries the entropy-coded scan, so the JPEG headers (DQT, DRI,
+// SOF0, DHT and SOS) are rebuilt from the RTP JPEG header: the quantization
+// tables are either sent in-band (Q 128-255) or derived from the Q factor as
+// in Appendix A of the RFC, and the Huffman tables are always the standard
+// ones. In-band tables of Q 128-254 may be left out of later images with the
+// same Q, which then reuse the last ones received. Types 0 and 1 (4:2:2 and 4:2:0) are supported, with restart markers
+// for types 64 and 65.
+//
+// The image is reassembled in a buffer reserved for the largest image seen so
+// far, so that appending the fragments does not reallocate. An image with a
+// missing fragment is dropped. The delegate receives each complete image with
+// its RTP timestamp and size.
+class MjpegDepacketizer {
+ private:
+  MjpegDepacketizer(MjpegDepacketizer const &) = delete;
+  MjpegDepacketizer(MjpegDepacketizer &&) = delete;
+  MjpegDepacketizer &operator=(MjpegDepacketizer const &) = delete;
+  MjpegDepacketizer &operator=(MjpegDepacketizer &&) = delete;
+
+ public:
+  using Delegate = std::function<void(std::string &&, uint32_t, uint32_t,
+      uint32_t)>;
+
+  // The width and height are used for images too large for the RTP JPEG
+  // header (above 2040 pixels), as announced in the session description.
+  MjpegDepacketizer(uint32_t width, uint32_t height, Delegate &&delegate)
+    : m_defaultWidth(width)
+    , m_defaultHeight(height)
+    , m_delegate(std::move(delegate))
+    , m_frame()
+    , m_capacity(INITIAL_CAPACITY)
+    , m_headerLength(0)
+    , m_timestamp(0)
+    , m_width(0)
+    , m_height(0)
+    , m_isComplete(false)
+    , m_tables()
+  {
+  }
+
+  void push(uint8_t const *payload, size_t length, uint32_t timestamp,
+      bool isMarker)
+  {
+    if (length < 8) {
+      return;
+    }
+    uint32_t const fragmentOffset{(static_cast<uint32_t>(payload[1]) << 16)
+      | (static_cast<uint32_t>(payload[2]) << 8) | payload[3]};
+    uint8_t const type{payload[4]};
+    uint8_t const q{payload[5]};
+    uint32_t const width{(0 != payload[6]) ? payload[6] * 8U : m_defaultWidth};
+    uint32_t const height{(0 != payload[7]) ? payload[7] * 8U
+      : m_defaultHeight};
+    size_t offset{8};
+
+    uint16_t restartInterval{0};
+    if (type >= 64 && type <= 127) {
+      if (length < offset + 4) {
+        return;
+      }
+      restartInterval = static_cast<uint16_t>((payload[offset] << 8)
+          | payload[offset + 1]);
+      offset += 4;
+    }
+    if ((type & 0x3f) > 1) {
+      return;
+    }
+
+    if (0 == fragmentOffset) {
+      // The first fragment starts a new image, which also discards a
+      // previous one whose last fragment was lost.
+      uint8_t tables[128];
+      if (q >= 128) {
+        if (length < offset + 4) {
+          return;
+        }
+        uint16_t const tablesLength{static_cast<uint16_t>(
+            (payload[offset + 2] << 8) | payload[offset + 3])};
+        offset += 4;
+        if (0 == tablesLength) {
+          // Only Q 255 has to send its tables with every image.
+          auto const cached = m_tables.find(q);
+          if (255 == q || cached == m_tables.end()) {
+            m_isComplete = false;
+            return;
+          }
+          memcpy(tables, cached->second.data(), sizeof(tables));
+        } else {
+          // Only 8-bit tables, one for luma and one for chroma.
+          if (0 != payload[offset - 3] || tablesLength < sizeof(tables)
+              || length < offset + tablesLength) {
+            m_isComplete = false;
+            return;
+          }
+          memcpy(tables, payload + offset, sizeof(tables));
+          offset += tablesLength;
+          if (255 != q) {
+            m_tables[q].assign(reinterpret_cast<char const *>(tables),
+                sizeof(tables));
+          }
+        }
+      } else {
+        makeTables(q, tables, tables + 64);
+      }
+
+      m_frame = std::string();
+      m_frame.reserve(m_capacity);
+      makeHeaders(type & 0x3f, width, height, tables, restartInterval);
+      m_headerLength = m_frame.size();
+      m_timestamp = timestamp;
+      m_width = width;
+      m_height = height;
+      m_isComplete = true;
+    } else if (!m_isComplete || timestamp != m_timestamp
+        || fragmentOffset != m_frame.size() - m_headerLength) {
+      // A fragment was lost.
+      m_isComplete = false;
+      return;
+    }
+
+    if (length > offset) {
+      m_frame.append(reinterpret_cast<char const *>(payload + offset),
+          length - offset);
+    }
+
+    if (isMarker && m_isComplete) {
+      size_t const size{m_frame.size()};
+      if (size < 2 || static_cast<char>(0xff) != m_frame[size - 2]
+          || static_cast<char>(0xd9) != m_frame[size - 1]) {
+        m_frame += "\xff\xd9";
+      }
+      if (m_frame.size() > m_capacity) {
+        m_capacity = m_frame.size();
+      }
+      m_isComplete = false;
+      m_delegate(std::move(m_frame), m_timestamp, m_width, m_height);
+      m_frame = std::string();
+    }
+  }
+
+ private:
+  static constexpr size_t INITIAL_CAPACITY{1024 * 1024};
+
+  // The quantization tables of Q 1-99 (RFC 2435, Appendix A), in zig-zag
+  // order as they appear in the DQT segment.
+  static void makeTables(uint8_t q, uint8_t *luma, uint8_t *chroma)
+  {
+    static uint8_t const JPEG_LUMA_QUANTIZER[64] = {
+      16, 11, 12, 14, 12, 10, 16, 14,
+      13, 14, 18, 17, 16, 19, 24, 40,
+      26, 24, 22, 22, 24, 49, 35, 37,
+      29, 40, 58, 51, 61, 60, 57, 51,
+      56, 55, 64, 72, 92, 78, 64, 68,
+      87, 69, 55, 56, 80, 109, 81, 87,
+      95, 98, 103, 104, 103, 62, 77, 113,
+      121, 112, 100, 120, 92, 101, 103, 99
+    };
+    static uint8_t const JPEG_CHROMA_QUANTIZER[64] = {
+      17, 18, 18, 24, 21, 24, 47, 26,
+      26, 47, 99, 66, 56, 66, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99
+    };
+
+    int32_t factor{q};
+    if (factor < 1) {
+      factor = 1;
+    } else if (factor > 99) {
+      factor = 99;
+    }
+    int32_t const scale{(factor < 50) ? 5000 / factor : 200 - factor * 2};
+    for (uint32_t i = 0; i < 64; ++i) {
+      int32_t lq{(JPEG_LUMA_QUANTIZER[i] * scale + 50) / 100};
+      int32_t cq{(JPEG_CHROMA_QUANTIZER[i] * scale + 50) / 100};
+      luma[i] = static_cast<uint8_t>((lq < 1) ? 1 : ((lq > 255) ? 255 : lq));
+      chroma[i] = static_cast<uint8_t>((cq < 1) ? 1 : ((cq > 255) ? 255 : cq));
+    }
+  }
+
+  void putMarker(uint8_t marker, uint16_t length)
+  {
+    m_frame.push_back(static_cast<char>(0xff));
+    m_frame.push_back(static_cast<char>(marker));
+    m_frame.push_back(static_cast<char>(length >> 8));
+    m_frame.push_back(static_cast<char>(length & 0xff));
+  }
+
+  void putHuffmanTable(uint8_t tableClassAndId, uint8_t const *codeLengths,
+      uint8_t const *symbols, uint16_t symbolCount)
+  {
+    putMarker(0xc4, static_cast<uint16_t>(3 + 16 + symbolCount));
+    m_frame.push_back(static_cast<char>(tableClassAndId));
+    m_frame.append(reinterpret_cast<char const *>(codeLengths), 16);
+    m_frame.append(reinterpret_cast<char const *>(symbols), symbolCount);
+  }
+
+  // The headers of RFC 2435, Appendix A (MakeHeaders).
+  void makeHeaders(uint8_t type, uint32_t width, uint32_t height,
+      uint8_t const *tables, uint16_t restartInterval)
+  {
+    static uint8_t const LUM_DC_CODELENS[16] = {
+      0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0
+    };
+    static uint8_t const LUM_DC_SYMBOLS[12] = {
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+    };
+    static uint8_t const LUM_AC_CODELENS[16] = {
+      0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d
+    };
+    static uint8_t const LUM_AC_SYMBOLS[162] = {
+      0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+      0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+      0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+      0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+      0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+      0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+      0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+      0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+      0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+      0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+      0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+      0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+      0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+      0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+      0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+      0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+      0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+      0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+      0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+      0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+      0xf9, 0xfa
+    };
+    static uint8_t const CHM_DC_CODELENS[16] = {
+      0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0
+    };
+    static uint8_t const CHM_DC_SYMBOLS[12] = {
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+    };
+    static uint8_t const CHM_AC_CODELENS[16] = {
+      0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77
+    };
+    static uint8_t const CHM_AC_SYMBOLS[162] = {
+      0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+      0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+      0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+      0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+      0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+      0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+      0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+      0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+      0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+      0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+      0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+      0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+      0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+      0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+      0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+      0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+      0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+      0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+      0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+      0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+      0xf9, 0xfa
+    };
+
+    // SOI
+    m_frame += "\xff\xd8";
+
+    // DQT, one table each for luma and chroma.
+    for (uint8_t i = 0; i < 2; ++i) {
+      putMarker(0xdb, 2 + 1 + 64);
+      m_frame.push_back(static_cast<char>(i));
+      m_frame.append(reinterpret_cast<char const *>(tables + i * 64), 64);
+    }
+
+    if (0 != restartInterval) {
+      putMarker(0xdd, 4);
+      m_frame.push_back(static_cast<char>(restartInterval >> 8));
+      m_frame.push_back(static_cast<char>(restartInterval & 0xff));
+    }
+
+    // SOF0, baseline with three components; type 0 is 4:2:2 and type 1 is
+    // 4:2:0.
+    putMarker(0xc0, 17);
+    m_frame.push_back(8);
+    m_frame.push_back(static_cast<char>(height >> 8));
+    m_frame.push_back(static_cast<char>(height & 0xff));
+    m_frame.push_back(static_cast<char>(width >> 8));
+    m_frame.push_back(static_cast<char>(width & 0xff));
+    m_frame.push_back(3);
+    m_frame.push_back(0);
+    m_frame.push_back((0 == type) ? 0x21 : 0x22);
+    m_frame.push_back(0);
+    m_frame.push_back(1);
+    m_frame.push_back(0x11);
+    m_frame.push_back(1);
+    m_frame.push_back(2);
+    m_frame.push_back(0x11);
+    m_frame.push_back(1);
+
+    putHuffmanTable(0x00, LUM_DC_CODELENS, LUM_DC_SYMBOLS,
+        sizeof(LUM_DC_SYMBOLS));
+    putHuffmanTable(0x10, LUM_AC_CODELENS, LUM_AC_SYMBOLS,
+        sizeof(LUM_AC_SYMBOLS));
+    putHuffmanTable(0x01, CHM_DC_CODELENS, CHM_DC_SYMBOLS,
+        sizeof(CHM_DC_SYMBOLS));
+    putHuffmanTable(0x11, CHM_AC_CODELENS, CHM_AC_SYMBOLS,
+        sizeof(CHM_AC_SYMBOLS));
+
+    // SOS
+    putMarker(0xda, 12);
+    m_frame.push_back(3);
+    m_frame.push_back(0);
+    m_frame.push_back(0x00);
+    m_frame.push_back(1);
+    m_frame.push_back(0x11);
+    m_frame.push_back(2);
+    m_frame.push_back(0x11);
+    m_frame.push_back(0);
+    m_frame.push_back(63);
+    m_frame.push_back(0);
+  }
+
+  uint32_t const m_defaultWidth;
+  uint32_t const m_defaultHeight;
+  Delegate m_delegate;
+  std::string m_frame;
+  size_t m_capacity;
+  size_t m_headerLength;
+  uint32_t m_timestamp;
+  uint32_t m_width;
+  uint32_t m_height;
+  bool m_isComplete;
+  // The last in-band tables received for each Q of 128-254.
+  std::map<uint8_t, std::string> m_tables;
+};
+
+#endif
@@ -15,6 +15,18 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
@@ -24,75 +36,166 @@
 #include <sstream>
 #include <string>
 #include <random>
+#include <thread>
+#include <vector>
 
 #include <curl/curl.h>
 
 #include <wels/codec_api.h>
 #include <libyuv.h>
-#include <X11/Xlib.h>
 
 #include "cluon-complete.hpp"
+#include "event-loop.hpp"
+#include "h264-depacketizer.hpp"
+#include "hevc-depacketizer.hpp"
+#include "image-output.hpp"
+#include "mjpeg-depacketizer.hpp"
 #include "opendlv-standard-message-set.hpp"
+#include "packet-recorder.hpp"
+#include "recorder.hpp"
+#include "rtp-receiver.hpp"
+#include "shared-memory-consumers.hpp"
 #include "sps-decoder.hpp"
+#include "worker-pool.hpp"
+#include "x11-preview.hpp"
+
+// One media section (m=) of a session description. Payload types are only
+// unique within a section, so each track keeps its own formats.
+struct SdpMedia {
+  std::string type{};
+  // The formats of the media, in the camera's order of preference.
+  std::vector<uint32_t> payloadTypes{};
+  std::map<uint32_t, std::string> encoding{};
+  std::map<uint32_t, std::string> vps{};
+  std::map<uint32_t, std::string> sps{};
+  std::map<uint32_t, std::string> pps{};
+  std::map<uint32_t, uint32_t> maxDonDiff{};
+  std::map<uint32_t, uint32_t> clockrate{};
+  std::string control{};
+  double framerate{0.0};
+  uint32_t width{0};
+  uint32_t height{0};
+};
 
 struct SdpData {
-  std::map<uint32_t, std::string> encoding;
-  std::map<uint32_t, std::string> sps;
-  std::map<uint32_t, std::string> pps;
-  std::map<uint32_t, uint32_t> clockrate;
-  std::map<uint32_t, std::string> streamUri;
-  double framerate;
+  std::vector<SdpMedia> media{};
+  std::string description{};
 };
 
 size_t parseSdpData(void *ptr, size_t size, size_t nmemb, void *userptr)
 {
   size_t nbytes = size * nmemb;
   SdpData *sdpData = static_cast<SdpData *>(userptr);
+  sdpData->description.append(static_cast<char *>(ptr), nbytes);
 
-  std::istringstream f(static_cast<char *>(ptr));
+  std::istringstream f(std::string(static_cast<char *>(ptr), nbytes));
   std::string line;
-  uint32_t latestPayloadType = 0;
   while (std::getline(f, line)) {
+    if (!line.empty() && '\r' == line.back()) {
+      line.pop_back();
+    }
+    {
+      // Everything after an m= line describes that media section.
+      std::string n("m=");
+      if (line.find(n) == 0) {
+        SdpMedia media{};
+        std::istringstream fields(line.substr(n.length()));
+        std::string port;
+        std::string protocol;
+        uint32_t payloadType;
+        fields >> media.type >> port >> protocol;
+        while (fields >> payloadType) {
+          media.payloadTypes.push_back(payloadType);
+          // Static payload types (RFC 3551) may come without an a=rtpmap.
+          if (26 == payloadType) {
+            media.encoding[26] = "JPEG";
+            media.clockrate[26] = 90000;
+          }
+        }
+        sdpData->media.push_back(media);
+        continue;
+      }
+    }
+    if (sdpData->media.empty()) {
+      // Session level attributes.
+      continue;
+    }
+    SdpMedia &media = sdpData->media.back();
     {
       std::string n("a=rtpmap:");
-      if (line.find(n) != -1) {
+      if (line.find(n) != std::string::npos) {
         std::string s = line.substr(n.length());
         uint32_t payloadType = std::stoi(s.substr(0, s.find(' ')));
-        latestPayloadType = payloadType;
         std::string encoding = s.substr(s.find(' ') + 1,
             s.find('/') - (s.find(' ') + 1));
+        // Encoding names are case-insensitive.
+        std::transform(encoding.begin(), encoding.end(), encoding.begin(),
+            [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
         uint32_t clockrate = std::stoi(s.substr(s.find('/') + 1));
-        sdpData->encoding[payloadType] = encoding;
-        sdpData->clockrate[payloadType] = clockrate;
+        media.encoding[payloadType] = encoding;
+        media.clockrate[payloadType] = clockrate;
       }
     }
     {
       std::string n("a=fmtp:");
-      if (line.find(n) != -1) {
+      if (line.find(n) != std::string::npos) {
         cluon::FromJSONVisitor base64Decoder;
 
         std::string s = line.substr(n.length());
         uint32_t payloadType = std::stoi(s.substr(0, s.find(' ')));
 
+        auto getParameter = [&s](std::string const &name) {
+            std::string const key{name + "="};
+            size_t const begin = s.find(key);
+            if (begin == std::string::npos) {
+              return std::string();
+            }
+            std::string value{s.substr(begin + key.length())};
+            return value.substr(0, value.find_first_of("; \r"));
+          };
+
         n = "sprop-parameter-sets=";
-        std::string spsAndPps = s.substr(s.find(n) + n.length());
-        int32_t i = spsAndPps.find(",");
-        sdpData->sps[payloadType] = 
-          base64Decoder.decodeBase64(spsAndPps.substr(0, i));
-        sdpData->pps[payloadType] = 
-          base64Decoder.decodeBase64(spsAndPps.substr(i + 1));
+        if (s.find(n) != std::string::npos) {
+          std::string spsAndPps = getParameter("sprop-parameter-sets");
+          size_t i = spsAndPps.find(",");
+          media.sps[payloadType] =
+            base64Decoder.decodeBase64(spsAndPps.substr(0, i));
+          media.pps[payloadType] =
+            base64Decoder.decodeBase64(spsAndPps.substr(i + 1));
+        } else {
+          // H.265, RFC 7798
+          media.vps[payloadType] =
+            base64Decoder.decodeBase64(getParameter("sprop-vps"));
+          media.sps[payloadType] =
+            base64Decoder.decodeBase64(getParameter("sprop-sps"));
+          media.pps[payloadType] =
+            base64Decoder.decodeBase64(getParameter("sprop-pps"));
+          std::string const maxDonDiff{getParameter("sprop-max-don-diff")};
+          media.maxDonDiff[payloadType] = maxDonDiff.empty() ? 0 :
+            std::stoi(maxDonDiff);
+        }
       }
     }
     {
       std::string n("a=control:");
-      if (line.find(n) != -1) {
-        sdpData->streamUri[latestPayloadType] = line.substr(n.length());
+      if (line.find(n) != std::string::npos) {
+        media.control = line.substr(n.length());
+      }
+    }
+    {
+      // The image size of JPEG streams, which the RTP JPEG header can only
+      // express up to 2040 pixels.
+      std::string n("a=x-dimensions:");
+      if (line.find(n) != std::string::npos) {
+        std::string s = line.substr(n.length());
+        media.width = std::stoi(s.substr(0, s.find(',')));
+        media.height = std::stoi(s.substr(s.find(',') + 1));
       }
     }
     {
       std::string n("a=framerate:");
-      if (line.find(n) != -1) {
-        sdpData->framerate = stod(line.substr(n.length()));
+      if (line.find(n) != std::string::npos) {
+        media.framerate = stod(line.substr(n.length()));
       }
     }
   }
@@ -120,6 +223,35 @@ std::string getHostname(std::string uri) {
   return tmp.substr(0, l);
 }
 
+// Signalled on SIGINT and SIGTERM, so that the main thread, which only
+// checks now and then whether the session is still running, wakes up at once.
+static int32_t g_terminationFd{-1};
+
+void handleTerminationSignal(int32_t)
+{
+  cluon::TerminateHandler::instance().isTerminated.store(true);
+  uint64_t const one{1};
+  ssize_t const n{::write(g_terminationFd, &one, sizeof(one))};
+  (void) n;
+}
+
+// Replaces cluon's handlers for SIGINT and SIGTERM with one that also
+// signals g_terminationFd; cluon components still see the termination.
+bool handleTerminationSignals()
+{
+  // cluon installs its handlers when the TerminateHandler is created.
+  cluon::TerminateHandler::instance();
+  g_terminationFd = ::eventfd(0, EFD_CLOEXEC);
+  if (-1 == g_terminationFd) {
+    return false;
+  }
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = &handleTerminationSignal;
+  return 0 == ::sigaction(SIGINT, &action, nullptr)
+    && 0 == ::sigaction(SIGTERM, &action, nullptr);
+}
+
 void sendMagicNumber(uint32_t srcPort, std::string addr, uint32_t dstPort)
 {
   int32_t fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
@@ -147,222 +279,564 @@ void sendMagicNumber(uint32_t srcPort, std::string addr, uint32_t dstPort)
   close(fd);
 }
 
-int32_t main(int32_t argc, char **argv)
+std::vector<std::string> getRepeatedArgument(int32_t argc, char **argv,
+    std::string const &key)
 {
-  int32_t retCode{1};
-  auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
-  if ( (0 == commandlineArguments.count("url")) ||
-      (0 == commandlineArguments.count("name")) ||
-      (0 == commandlineArguments.count("cid")) ) {
-    std::cerr << argv[0] << " interfaces with the given RTSP/RTP-based camera "
-      << "and sends the compressed frames as OpenDLV messages." << std::endl
-      << "Usage:   " << argv[0] << " --url=<URL> --cid=<CID> --name=<NAME>"
-      << "[--server-port-udp-a=<Port>] [--id=<ID>] "
-      << "[--verbose]" << std::endl
-      << "         --cid:       CID of the OD4Session to receive Envelopes for "
-      << "recording" << std::endl
-      << "         --server-port-udp-a: The first UDP port to use (the second "
-      << "will always be the number after)"
-      << std::endl
-      << "         --id:        ID to use in case of multiple instances of "
-         "running microservices." 
-      << std::endl
-      << "         --name:      name of the shared memory segment for the decoded h264 frame in ARGB/i420 pixel layouts" << std::endl
-      << "         --url:       URL providing an MJPEG stream over http" 
-      << std::endl
-      << "         --verbose:   show further information" << std::endl
-      << "         --remote:    enable remotely activated recording" << std::endl
-      << "         --rec:       name of the recording file; default: YYYY-MM-DD_HHMMSS.rec" << std::endl
-      << "         --recsuffix: additional suffix to add to the .rec file" << std::endl
-      << "Example: " << argv[0] << " --url=rtsp://10.42.42.128/axis-media/media.amp?camera=1 --cid=102 --id=0 --client-port-udp-a=35000 --remote --recsuffix=-rtp" << std::endl;
-  } else {
-    std::string const url{commandlineArguments["url"]};
-    uint32_t senderStamp{(commandlineArguments.count("id") != 0) ?
-        static_cast<uint32_t>(std::stoi(commandlineArguments["id"])) : 0};
-    bool verbose{commandlineArguments.count("verbose") != 0};
-    const std::string NAME{commandlineArguments["name"]};
-    const std::string NAME_ARGB{NAME + "argb"};
-    const std::string NAME_I420{NAME + "i420"};
-
-    uint32_t const serverPortA = {
-      (commandlineArguments.count("server-port-udp-a") != 0) ?
-        static_cast<uint32_t>(
-            std::stoi(commandlineArguments["server-port-udp-a"])) : 50000};
-    uint32_t const serverPortB = serverPortA + 1;
-    
-    uint32_t const clientPortA = {
-      (commandlineArguments.count("client-port-udp-a") != 0) ?
-        static_cast<uint32_t>(
-            std::stoi(commandlineArguments["client-port-udp-a"])) : 33000};
-    uint32_t const clientPortB = clientPortA + 1;
+  std::vector<std::string> values;
+  std::string const prefix{"--" + key + "="};
+  for (int32_t i = 1; i < argc; ++i) {
+    std::string const arg{argv[i]};
+    if (0 == arg.find(prefix)) {
+      values.push_back(arg.substr(prefix.length()));
+    }
+  }
+  return values;
+}
 
-    auto getYYYYMMDD_HHMMSS = [](){
-      cluon::data::TimeStamp now = cluon::time::now();
+enum class Codec {
+  H264,
+  H265,
+  MJPEG
+};
 
-      const long int _seconds = now.seconds();
-      struct tm *tm = localtime(&_seconds);
+enum class DecodeMode {
+  ALWAYS,
+  ON_DEMAND,
+  NEVER
+};
 
-      uint32_t year = (1900 + tm->tm_year);
-      uint32_t month = (1 + tm->tm_mon);
-      uint32_t dayOfMonth = tm->tm_mday;
-      uint32_t hours = tm->tm_hour;
-      uint32_t minutes = tm->tm_min;
-      uint32_t seconds = tm->tm_sec;
+// What to drop while the decoder lags behind the camera by more than the
+// configured budget: only the frames no other frame refers to
+// (nal_ref_idc == 0), or the rest of the group of pictures up to the next
+// keyframe.
+enum class OverloadPolicy {
+  NON_REFERENCE,
+  GOP
+};
 
-      std::stringstream sstr;
-      sstr << year << "-" << ( (month < 10) ? "0" : "" ) << month << "-" << ( (dayOfMonth < 10) ? "0" : "" ) << dayOfMonth
-                     << "_" << ( (hours < 10) ? "0" : "" ) << hours
-                     << ( (minutes < 10) ? "0" : "" ) << minutes
-                     << ( (seconds < 10) ? "0" : "" ) << seconds;
+struct StreamConfig {
+  std::string url{};
+  std::string name{};
+  uint32_t senderStamp{0};
+  uint32_t clientPortA{0};
+  uint32_t serverPortA{0};
+  int32_t track{-1};
+  uint32_t worker{0};
+  std::vector<int32_t> rtpCpus{};
+  int32_t rtpPriority{0};
+  int32_t receiveBufferSize{0};
+  bool isHardwareTimestamping{false};
+  int32_t busyPollMicroseconds{0};
+  bool isMeasuringLatency{false};
+  int64_t maxDecodeLagInMicroseconds{0};
+  OverloadPolicy overloadPolicy{OverloadPolicy::GOP};
+  DecodeMode decodeMode{DecodeMode::ALWAYS};
+  std::vector<OutputSpec> outputs{};
+  double argbRate{0.0};
+  double i420Rate{0.0};
+  bool isPreviewing{false};
+  double previewRate{60.0};
+};
 
-      std::string retVal{sstr.str()};
-      return retVal;
-    };
-    const bool REMOTE{commandlineArguments.count("remote") != 0};
-    const std::string REC{(commandlineArguments["rec"].size() != 0) ? commandlineArguments["rec"] : ""};
-    const std::string RECSUFFIX{commandlineArguments["recsuffix"]};
-    const std::string NAME_RECFILE{(REC.size() != 0) ? REC + RECSUFFIX : (getYYYYMMDD_HHMMSS() + RECSUFFIX + ".rec")};
+// The RTSP session with one camera, shared by the streams receiving its
+// tracks: the session description is fetched once, each stream sets up its
+// own track on its own client ports, and the session is played once all
+// tracks are set up. While playing, a thread of the session's own sends the
+// keep-alives, so that a slow camera never holds up the reception of its
+// tracks; the requests are serialised, and time out.
+class RtspSession {
+ private:
+  RtspSession(RtspSession const &) = delete;
+  RtspSession(RtspSession &&) = delete;
+  RtspSession &operator=(RtspSession const &) = delete;
+  RtspSession &operator=(RtspSession &&) = delete;
+
+ public:
+  explicit RtspSession(std::string const &url)
+    : m_url(url)
+    , m_mutex()
+    , m_curl(curl_easy_init())
+    , m_localHostname()
+    , m_sdpData()
+    , m_isDescribed(false)
+    , m_isPlaying(false)
+    , m_isTornDown(false)
+    , m_keepAliveMutex()
+    , m_keepAliveCondition()
+    , m_isKeepAliveStopped(false)
+    , m_keepAliveThread()
+  {
+    curl_easy_setopt(m_curl, CURLOPT_VERBOSE, 0);
+    curl_easy_setopt(m_curl, CURLOPT_NOPROGRESS, 1);
+    curl_easy_setopt(m_curl, CURLOPT_CONNECTTIMEOUT, 5L);
+    curl_easy_setopt(m_curl, CURLOPT_TIMEOUT, 10L);
+    curl_easy_setopt(m_curl, CURLOPT_URL, m_url.c_str());
+   // curl_easy_setopt(m_curl, CURLOPT_HTTPAUTH, CURLAUTH_DIGEST);
+  }
 
-    if (verbose) {
-      std::cout << "Using client ports " << clientPortA << "-" << clientPortB 
-        << std::endl;
+  ~RtspSession()
+  {
+    teardown();
+    curl_easy_cleanup(m_curl);
+  }
+
+  // Asks for the options and the session description, once.
+  SdpData const &describe()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_isDescribed) {
+      return m_sdpData;
+    }
+
+    // RTSP options
+    curl_easy_setopt(m_curl, CURLOPT_RTSP_STREAM_URI, m_url.c_str());
+    curl_easy_setopt(m_curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_OPTIONS);
+    curl_easy_perform(m_curl);
+
+    {
+      char *ip;
+      curl_easy_getinfo(m_curl, CURLINFO_LOCAL_IP, &ip);
+      m_localHostname = std::string(ip);
     }
 
+    // RTSP describe
+    curl_easy_setopt(m_curl, CURLOPT_WRITEDATA, &m_sdpData);
+    curl_easy_setopt(m_curl, CURLOPT_WRITEFUNCTION, parseSdpData);
+    curl_easy_setopt(m_curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_DESCRIBE);
+    curl_easy_perform(m_curl);
+    curl_easy_setopt(m_curl, CURLOPT_WRITEDATA, stdout);
+    curl_easy_setopt(m_curl, CURLOPT_WRITEFUNCTION, nullptr);
+
+    m_isDescribed = true;
+    return m_sdpData;
+  }
+
+  std::string const &localHostname() const
+  {
+    return m_localHostname;
+  }
+
+  // Sets up one track; relative control URLs are resolved against the
+  // session URL.
+  void setupTrack(std::string const &control, std::string const &transport)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string streamUri{m_url};
+    if (0 == control.find("rtsp://")) {
+      streamUri = control;
+    } else if (!control.empty() && "*" != control) {
+      streamUri += ('/' == m_url.back() ? "" : "/") + control;
+    }
+    curl_easy_setopt(m_curl, CURLOPT_RTSP_STREAM_URI, streamUri.c_str());
+    curl_easy_setopt(m_curl, CURLOPT_RTSP_TRANSPORT, transport.c_str());
+    curl_easy_setopt(m_curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_SETUP);
+    curl_easy_perform(m_curl);
+  }
+
+  void play()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_isPlaying) {
+      return;
+    }
+    std::string const range("npt=0.000-");
+
+    // RTSP play
+    curl_easy_setopt(m_curl, CURLOPT_RTSP_STREAM_URI, m_url.c_str());
+    curl_easy_setopt(m_curl, CURLOPT_RANGE, range.c_str());
+    curl_easy_setopt(m_curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_PLAY);
+    curl_easy_perform(m_curl);
+    curl_easy_setopt(m_curl, CURLOPT_RANGE, nullptr);
+    m_isPlaying = true;
+    m_keepAliveThread = std::thread([this]() { keepAlive(); });
+  }
+
+  void teardown()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_keepAliveMutex);
+      m_isKeepAliveStopped = true;
+    }
+    m_keepAliveCondition.notify_all();
+    if (m_keepAliveThread.joinable()) {
+      m_keepAliveThread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_isDescribed && !m_isTornDown) {
+      // RTSP teardown
+      curl_easy_setopt(m_curl, CURLOPT_RTSP_STREAM_URI, m_url.c_str());
+      curl_easy_setopt(m_curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_TEARDOWN);
+      curl_easy_perform(m_curl);
+      m_isTornDown = true;
+    }
+  }
+
+ private:
+  // Sends an OPTIONS request every 50 s until the session is torn down.
+  void keepAlive()
+  {
+    std::chrono::seconds const interval{50};
+    std::unique_lock<std::mutex> keepAliveLock(m_keepAliveMutex);
+    while (!m_keepAliveCondition.wait_for(keepAliveLock, interval,
+          [this]() { return m_isKeepAliveStopped; })) {
+      keepAliveLock.unlock();
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        curl_easy_setopt(m_curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_OPTIONS);
+        curl_easy_perform(m_curl);
+      }
+      keepAliveLock.lock();
+    }
+  }
+
+  std::string const m_url;
+  std::mutex m_mutex;
+  CURL *m_curl;
+  std::string m_localHostname;
+  SdpData m_sdpData;
+  bool m_isDescribed;
+  bool m_isPlaying;
+  bool m_isTornDown;
+  std::mutex m_keepAliveMutex;
+  std::condition_variable m_keepAliveCondition;
+  bool m_isKeepAliveStopped;
+  std::thread m_keepAliveThread;
+};
+
+// One video track of an RTSP/RTP camera: its depacketizer, decoder and shared
+// memory outputs. RTP and RTCP are handled on the stream's single event loop
+// thread, while the decoding and colour conversion is
+// posted to the stream's worker. Instead of a camera, a raw packet dump can be
+// replayed into the stream.
+class RtpStream {
+ private:
+  RtpStream(RtpStream const &) = delete;
+  RtpStream(RtpStream &&) = delete;
+  RtpStream &operator=(RtpStream const &) = delete;
+  RtpStream &operator=(RtpStream &&) = delete;
+
+ public:
+  RtpStream(StreamConfig const &config, bool verbose, Recorder &recorder,
+      WorkerPool &workerPool, PacketRecorder *packetRecorder,
+      RtspSession *session)
+    : m_config(config)
+    , m_verbose(verbose)
+    , m_recorder(recorder)
+    , m_decodeQueue(workerPool.connect(config.worker, DECODE_QUEUE_SIZE))
+    , m_packetRecorder(packetRecorder)
+    , m_session(session)
+    , m_nameArgb(config.name + "argb")
+    , m_nameI420(config.name + "i420")
+    , m_clientPortB(config.clientPortA + 1)
+    , m_serverPortB(config.serverPortA + 1)
+    , m_hostname(getHostname(config.url))
+    , m_argbDecimator(config.argbRate)
+    , m_i420Decimator(config.i420Rate)
+  {
     std::random_device rd;
     std::mt19937_64 gen(rd());
     std::uniform_int_distribution<uint32_t> dis;
+    m_clientSsrc = dis(gen);
+
+    // The additional outputs are spread over the workers following the
+    // stream's own, so that they are converted in parallel.
+    for (uint32_t i = 0; i < m_config.outputs.size(); ++i) {
+      uint32_t const worker{m_config.worker + 1 + i};
+      Output output;
+      output.isInline = (worker % workerPool.size())
+        == (m_config.worker % workerPool.size());
+      if (!output.isInline) {
+        output.queue = workerPool.connect(worker, DECODE_QUEUE_SIZE);
+      }
+      m_outputs.push_back(std::move(output));
+    }
+  }
 
-    std::string hostname = getHostname(url);
-    std::string localHostname;
+  ~RtpStream()
+  {
+    stop();
 
-    uint32_t const clientSsrc = dis(gen);
+    if (m_decoder) {
+      m_decoder->Uninitialize();
+      WelsDestroyDecoder(m_decoder);
+    }
 
-    std::unique_ptr<cluon::OD4Session> od4{new cluon::OD4Session(static_cast<uint16_t>(std::stoi(commandlineArguments["cid"])))};
+    m_preview.reset();
+  }
 
-    std::string nameOfRecFile;
-    std::mutex recFileMutex{};
-    std::unique_ptr<std::fstream> recFile{nullptr};
-    if (!REMOTE) {
-      recFile.reset(new std::fstream(NAME_RECFILE.c_str(), std::ios::out|std::ios::binary|std::ios::trunc));
-      std::cout << "[opendlv-video-camera-rtp]: Created " << NAME_RECFILE << "." << std::endl;
+  // Sets up the stream's track within the session; the session is played
+  // once all of its tracks are set up.
+  bool setup()
+  {
+    if (m_verbose) {
+      std::cout << "Using client ports " << m_config.clientPortA << "-"
+        << m_clientPortB << " for " << m_config.url << std::endl;
     }
-    else {
-      od4.reset(new cluon::OD4Session(static_cast<uint16_t>(std::stoi(commandlineArguments["cid"])),
-          [REC, RECSUFFIX, getYYYYMMDD_HHMMSS, &recFileMutex, &recFile, &nameOfRecFile](cluon::data::Envelope &&envelope) noexcept {
-        if (cluon::data::RecorderCommand::ID() == envelope.dataType()) {
-          std::lock_guard<std::mutex> lck(recFileMutex);
-          cluon::data::RecorderCommand rc = cluon::extractMessage<cluon::data::RecorderCommand>(std::move(envelope));
-          if (1 == rc.command()) {
-            if (recFile && recFile->good()) {
-              recFile->flush();
-              recFile->close();
-              recFile = nullptr;
-              std::cout << "[opendlv-video-camera-rtp]: Closed " << nameOfRecFile << "." << std::endl;
-            }
-            nameOfRecFile = (REC.size() != 0) ? REC + RECSUFFIX : (getYYYYMMDD_HHMMSS() + RECSUFFIX + ".rec");
-            recFile.reset(new std::fstream(nameOfRecFile.c_str(), std::ios::out|std::ios::binary|std::ios::trunc));
-            std::cout << "[opendlv-video-camera-rtp]: Created " << nameOfRecFile << "." << std::endl;
-          }
-          else if (2 == rc.command()) {
-            if (recFile && recFile->good()) {
-              recFile->flush();
-              recFile->close();
-              std::cout << "[opendlv-video-camera-rtp]: Closed " << nameOfRecFile << "." << std::endl;
-            }
-            recFile = nullptr;
-          }
-        }
-        else {
-          std::lock_guard<std::mutex> lck(recFileMutex);
-          if (recFile && recFile->good()) {
-            std::string serializedData{cluon::serializeEnvelope(std::move(envelope))};
-            recFile->write(serializedData.data(), serializedData.size());
-            recFile->flush();
-          }
-        }
-      }));
+
+    std::string const transport("RTP/AVP;unicast;client_port=" 
+        + std::to_string(m_config.clientPortA) + "-"
+        + std::to_string(m_clientPortB));
+
+    SdpData const &sdpData{m_session->describe()};
+
+    if (m_packetRecorder) {
+      m_packetRecorder->write(PacketKind::SDP, m_config.senderStamp,
+          std::chrono::system_clock::now(), sdpData.description.data(),
+          sdpData.description.size());
     }
 
-    CURL *curl = curl_easy_init();
+    // RTSP setup
+    if (!selectTrack(sdpData)) {
+      return false;
+    }
+    if (m_verbose) {
+      std::cout << "Found " << m_media.encoding[m_payloadType]
+        << " stream at " << m_media.control << ". Setting up." << std::endl;
+    }
+    m_session->setupTrack(m_media.control, transport);
 
-    curl_easy_setopt(curl, CURLOPT_VERBOSE, 0);
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1);
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-   // curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_DIGEST);
+    // Send magic number
+    sendMagicNumber(m_config.clientPortA, m_hostname, m_config.serverPortA);
+    sendMagicNumber(m_clientPortB, m_hostname, m_serverPortB);
 
-    std::string const transport("RTP/AVP;unicast;client_port=" 
-        + std::to_string(clientPortA) + "-" + std::to_string(clientPortB));
-    std::string const range("npt=0.000-");
+    return setupDecoder();
+  }
 
-    // RTSP options
-    curl_easy_setopt(curl, CURLOPT_RTSP_STREAM_URI, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_OPTIONS);
-    curl_easy_perform(curl);
+  // Takes the session description from a raw packet dump instead of the
+  // camera; the RTP and RTCP packets are then fed in with replay().
+  bool setupReplay(std::string const &description)
+  {
+    if (m_isReplaying) {
+      return true;
+    }
+    SdpData sdpData{};
+    std::string sdp{description};
+    parseSdpData(&sdp[0], 1, sdp.size(), &sdpData);
+    if (!selectTrack(sdpData)) {
+      return false;
+    }
+    m_isReplaying = true;
+    return setupDecoder();
+  }
 
-    {
-      char *ip;
-      curl_easy_getinfo(curl, CURLINFO_LOCAL_IP, &ip);
-      localHostname = std::string(ip);
+  void replay(RecordedPacket const &packet)
+  {
+    if (!m_isReplaying) {
+      // No session description seen yet.
+      return;
+    }
+    std::chrono::system_clock::time_point received{
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::microseconds(packet.receivedInMicroseconds))};
+    if (PacketKind::RTP == packet.kind) {
+      onStreamData(packet.data.data(), packet.data.size(), received);
+    } else if (PacketKind::RTCP == packet.kind) {
+      onControlData(packet.data.data(), packet.data.size(), received);
     }
+  }
 
-    // RTSP describe
-    SdpData sdpData;
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sdpData);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, parseSdpData);
-    curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_DESCRIBE);
-    curl_easy_perform(curl);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, stdout);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, nullptr);
+  void start()
+  {
+    ScopedThreadTuning tuning(m_config.rtpCpus, m_config.rtpPriority);
+
+    m_streamReceiver.reset(new RtpReceiver(m_session->localHostname(),
+        static_cast<uint16_t>(m_config.clientPortA),
+        m_config.receiveBufferSize, m_config.isHardwareTimestamping,
+        m_config.busyPollMicroseconds,
+        [this](char const *data, size_t length,
+          std::chrono::system_clock::time_point const &received) {
+          if (m_packetRecorder) {
+            m_packetRecorder->write(PacketKind::RTP, m_config.senderStamp,
+                received, data, length);
+          }
+          onStreamData(data, length, received);
+        }));
+
+    m_controlReceiver.reset(new RtpReceiver(m_session->localHostname(),
+        static_cast<uint16_t>(m_clientPortB),
+        m_config.receiveBufferSize, m_config.isHardwareTimestamping,
+        m_config.busyPollMicroseconds,
+        [this](char const *data, size_t length,
+          std::chrono::system_clock::time_point const &received) {
+          if (m_packetRecorder) {
+            m_packetRecorder->write(PacketKind::RTCP, m_config.senderStamp,
+                received, data, length);
+          }
+          onControlData(data, length, received);
+        }));
+
+    m_eventLoop.reset(new EventLoop(
+          std::chrono::microseconds(m_config.busyPollMicroseconds)));
+    m_eventLoop->add(m_streamReceiver->fd(), [this]() {
+        m_streamReceiver->receive();
+      });
+    m_eventLoop->add(m_controlReceiver->fd(), [this]() {
+        m_controlReceiver->receive();
+      });
+    m_eventLoop->start();
+  }
 
-    // RTSP setup
-    for (auto &streamUri : sdpData.streamUri) {
-      if (streamUri.first == 96) {
-        if (verbose) {
-          std::cout << "Found H.264 stream at " << streamUri.second 
-            << ". Setting up." << std::endl;
-        }
-        curl_easy_setopt(curl, CURLOPT_RTSP_STREAM_URI, streamUri.second.c_str());
-        curl_easy_setopt(curl, CURLOPT_RTSP_TRANSPORT, transport.c_str());
-        curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_SETUP);
-        curl_easy_perform(curl);
-      }
+  void stop()
+  {
+    m_eventLoop.reset();
+    if (m_streamReceiver && m_verbose) {
+      std::cout << "Kernel dropped " << m_streamReceiver->droppedPackets()
+        << " RTP packets of " << m_config.name << "." << std::endl;
     }
+    if (m_verbose) {
+      std::cout << "Dropped " << m_droppedFrames << " frames of "
+        << m_config.name << " to keep up with the camera." << std::endl;
+    }
+    m_streamReceiver.reset();
+    m_controlReceiver.reset();
+  }
 
-    // Send magic number
-    sendMagicNumber(clientPortA, hostname, serverPortA);
-    sendMagicNumber(clientPortB, hostname, serverPortB);
+ private:
+  static constexpr uint32_t DECODE_QUEUE_SIZE{16};
+  static constexpr uint32_t LATENCY_WINDOW{300};
+
+  // How the packets of one RTP payload type are handled, looked up by the
+  // payload type of every packet. Payload types the session did not
+  // negotiate have no depacketizer.
+  struct PayloadFormat {
+    uint32_t clockRate{90000};
+    void (RtpStream::*depacketize)(uint8_t const *, size_t, uint32_t, bool,
+        std::chrono::system_clock::time_point const &){nullptr};
+  };
+
+  // An additional output and the worker it is converted on, unless that is
+  // the stream's own.
+  struct Output {
+    std::unique_ptr<ImageOutput> image{nullptr};
+    WorkerPool::Producer queue{};
+    bool isInline{false};
+    bool isDue{false};
+  };
+
+  bool setupDecoder()
+  {
+    std::string const &sps{m_media.sps[m_payloadType]};
+    PayloadFormat &format{m_payloadFormats[m_payloadType]};
+    format.clockRate = (0 != m_media.clockrate[m_payloadType])
+      ? m_media.clockrate[m_payloadType] : 90000;
+    m_clockRate = format.clockRate;
+    if (Codec::MJPEG == m_codec) {
+      // Known up front only if announced; otherwise from the first image.
+      format.depacketize = &RtpStream::depacketizeMjpeg;
+      m_width = m_media.width;
+      m_height = m_media.height;
+    } else if (Codec::H265 == m_codec) {
+      format.depacketize = &RtpStream::depacketizeH265;
+      SpsInfo spsInfo = decodeHevcSps(
+          reinterpret_cast<uint8_t const *>(sps.data()),
+          static_cast<uint32_t>(sps.length()));
+      m_width = spsInfo.width;
+      m_height = spsInfo.height;
+    } else {
+      format.depacketize = &RtpStream::depacketizeH264;
+      SpsInfo spsInfo = decodeSps(reinterpret_cast<uint8_t const *>(sps.data()),
+          sps.length());
+      m_width = spsInfo.width;
+      m_height = spsInfo.height;
+    }
 
-    // RTSP play
-    curl_easy_setopt(curl, CURLOPT_RTSP_STREAM_URI, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
-    curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_PLAY);
-    curl_easy_perform(curl);
-    curl_easy_setopt(curl, CURLOPT_RANGE, nullptr);
+    if (m_isReplaying) {
+      std::cout << "Replaying RTP camera " << m_config.name << ". Resolution "
+        << m_width << "x" << m_height << ", framerate "
+        << m_media.framerate << std::endl;
+    } else {
+      std::cout << "Connection to RTP camera " << m_config.url
+        << " established. Resolution " << m_width << "x" << m_height
+        << ", framerate " << m_media.framerate << std::endl;
+    }
+
+    if (Codec::H265 == m_codec) {
+      m_hevcDepacketizer.reset(new HevcDepacketizer(
+            m_media.vps[m_payloadType], m_media.sps[m_payloadType],
+            m_media.pps[m_payloadType],
+            0 < m_media.maxDonDiff[m_payloadType],
+            [this](std::string &&accessUnit, uint32_t timestamp,
+              bool isKeyframe, bool isReference, std::string &&parameterSets) {
+              m_outData = std::move(accessUnit);
+              if (m_verbose) {
+                std::cout << "Received " << m_outData.size()
+                  << " bytes (H.265 access unit)." << std::endl;
+              }
+              onFrame(timestamp, isKeyframe, isReference,
+                  std::move(parameterSets), m_packetReceived);
+            }));
+      if (DecodeMode::NEVER != m_config.decodeMode) {
+        std::cerr << "[opendlv-device-camera-rtp]: Decoding H.265 is not "
+          << "supported, " << m_config.name << " is only recorded."
+          << std::endl;
+      }
+      return true;
+    }
 
+    if (Codec::MJPEG == m_codec) {
+      // Every JPEG image stands on its own: a keyframe no other image refers
+      // to.
+      m_mjpegDepacketizer.reset(new MjpegDepacketizer(m_width, m_height,
+            [this](std::string &&image, uint32_t timestamp, uint32_t width,
+              uint32_t height) {
+              if (0 == m_width || 0 == m_height) {
+                m_width = width;
+                m_height = height;
+                if (m_canDecode) {
+                  createSharedMemory();
+                }
+              }
+              m_outData = std::move(image);
+              if (m_verbose) {
+                std::cout << "Received " << m_outData.size()
+                  << " bytes (JPEG image)." << std::endl;
+              }
+              onFrame(timestamp, true, false, std::string(),
+                  m_packetReceived);
+            }));
+      if (DecodeMode::NEVER == m_config.decodeMode) {
+        return true;
+      }
+#ifdef HAVE_JPEG
+      m_canDecode = true;
+      if (0 != m_width && 0 != m_height) {
+        createSharedMemory();
+      }
+#else
+      std::cerr << "[opendlv-device-camera-rtp]: Decoding JPEG needs libyuv "
+        << "with libjpeg, " << m_config.name << " is only recorded."
+        << std::endl;
+#endif
+      return true;
+    }
 
-    // TODO: make right (properly support different payload types)
-    SpsInfo spsInfo = decodeSps(
-        reinterpret_cast<uint8_t const *>(sdpData.sps[96].data()),
-        sdpData.sps[96].length());
-    uint32_t width = spsInfo.width;
-    uint32_t height = spsInfo.height;
+    m_h264Depacketizer.reset(new H264Depacketizer(sps,
+          m_media.pps[m_payloadType],
+          [this](std::string &&accessUnit, uint32_t timestamp,
+            bool isKeyframe, bool isReference, std::string &&parameterSets) {
+            m_outData = std::move(accessUnit);
+            if (m_verbose) {
+              std::cout << "Received " << m_outData.size()
+                << " bytes (H.264 access unit)." << std::endl;
+            }
+            onFrame(timestamp, isKeyframe, isReference,
+                std::move(parameterSets), m_packetReceived);
+          }));
 
-    std::cout << "Connection to RTP camera established. Resolution " 
-      << width << "x" << height << ", framerate " << sdpData.framerate 
-      << std::endl;
+    if (DecodeMode::NEVER == m_config.decodeMode) {
+      return true;
+    }
 
     // h264 decoder
-    ISVCDecoder *decoder{nullptr};
-    WelsCreateDecoder(&decoder);
-    if (0 != WelsCreateDecoder(&decoder) && (nullptr != decoder)) {
-      std::cerr << argv[0] << ": Failed to create openh264 decoder." << std::endl;
-      return retCode;
+    if (0 != WelsCreateDecoder(&m_decoder) || (nullptr == m_decoder)) {
+      std::cerr << "[opendlv-device-camera-rtp]: Failed to create openh264 "
+        << "decoder." << std::endl;
+      return false;
     }
-    std::unique_ptr<cluon::SharedMemory> sharedMemoryARGB(nullptr);
-    std::unique_ptr<cluon::SharedMemory> sharedMemoryI420(nullptr);
 
-    int logLevel{verbose ? WELS_LOG_INFO : WELS_LOG_QUIET};
-    decoder->SetOption(DECODER_OPTION_TRACE_LEVEL, &logLevel);
+    int logLevel{m_verbose ? WELS_LOG_INFO : WELS_LOG_QUIET};
+    m_decoder->SetOption(DECODER_OPTION_TRACE_LEVEL, &logLevel);
 
     SDecodingParam decodingParam;
     {
@@ -371,419 +845,1218 @@ int32_t main(int32_t argc, char **argv)
       decodingParam.bParseOnly = false;
       decodingParam.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_DEFAULT;
     }
-    if (cmResultSuccess != decoder->Initialize(&decodingParam)) {
-      std::cerr << argv[0] << ": Failed to initialize openh264 decoder." << std::endl;
-      return retCode;
+    if (cmResultSuccess != m_decoder->Initialize(&decodingParam)) {
+      std::cerr << "[opendlv-device-camera-rtp]: Failed to initialize "
+        << "openh264 decoder." << std::endl;
+      return false;
     }
 
-    Display *display{nullptr};
-    Visual *visual{nullptr};
-    Window window{0};
-    XImage *ximage{nullptr};
-
-
-    std::string outData;
+    m_canDecode = true;
+    createSharedMemory();
+    return true;
+  }
 
-    std::mutex rtcpMutex;
-    cluon::data::TimeStamp latestNtpTime;
-    uint64_t latestRtpTime;
-    double jitter = 700.0; // TODO: Calculate jitter (easy)
-    uint32_t highestSeq = 0;
+  // The shared memory must exist up front for consumers to attach to it,
+  // which is what decoding on demand waits for.
+  void createSharedMemory()
+  {
+    std::clog << "[opendlv-device-camera-rtp]: Created shared memory " << m_nameArgb << " (" << (m_width * m_height * 4) << " bytes) for an ARGB image (width = " << m_width << ", height = " << m_height << ")." << std::endl;
+    m_sharedMemoryARGB.reset(new cluon::SharedMemory{m_nameArgb, m_width * m_height * 4});
+    uint32_t const i420Size{imageSize(PixelFormat::I420, m_width, m_height)};
+    std::clog << "[opendlv-device-camera-rtp]: Created shared memory " << m_nameI420 << " (" << i420Size << " bytes) for an I420 image (width = " << m_width << ", height = " << m_height << ")." << std::endl;
+    m_sharedMemoryI420.reset(new cluon::SharedMemory{m_nameI420, i420Size});
+
+    for (uint32_t i = 0; i < m_outputs.size(); ++i) {
+      OutputSpec const &spec{m_config.outputs[i]};
+      std::string const size{(0 != spec.cropWidth) ? "roi" :
+        ((0 == spec.width) ? "" :
+         std::to_string(spec.width) + "x" + std::to_string(spec.height))};
+      m_outputs[i].image.reset(new ImageOutput(m_config.name + size
+            + toString(spec.format), spec, m_width, m_height));
+    }
 
-    auto onStreamData =
-      [&od4, &recFileMutex, &recFile, &outData, &width, &height, &sdpData, &rtcpMutex,
-      &latestNtpTime, &latestRtpTime, &highestSeq, &senderStamp, &verbose, NAME_ARGB,
-      NAME_I420, &display, &visual, &window, &ximage, &sharedMemoryARGB,
-      &sharedMemoryI420, &decoder](
-        std::string &&data, std::string &&,
-        std::chrono::system_clock::time_point &&) noexcept {
-      char const *buf_start = static_cast<char const *>(data.c_str());
+    if (m_config.isPreviewing) {
+      m_preview.reset(new X11Preview(m_config.name, *m_sharedMemoryARGB,
+            m_width, m_height, m_config.previewRate));
+    }
+  }
 
-      static uint8_t const nalPrefix[] = {0x00, 0x00, 0x00, 0x01};
+  // Decides which outputs take the frame of the given media time, as limited
+  // by their rates, and tells whether any does.
+  bool selectOutputs(int64_t mediaTime)
+  {
+    m_isArgbDue = m_argbDecimator.isDue(mediaTime);
+    m_isI420Due = m_i420Decimator.isDue(mediaTime);
+    bool isAnyDue{m_isArgbDue || m_isI420Due};
+    for (auto &output : m_outputs) {
+      output.isDue = output.image->isDue(mediaTime);
+      isAnyDue |= output.isDue;
+    }
+    return isAnyDue;
+  }
 
-      uint8_t const b0 = *buf_start;
-     // uint8_t const version = (b0 >> 6);
-      bool const hasPadding = (b0 & 0x20) >> 5;
-     // bool const hasExtension = (b0 & 0x10) >> 4;
-     // uint8_t const csrcCount = (b0 & 0xf);
-      
-      uint8_t const b1 = *(buf_start + 1);
-     // bool const profileMarker = (b1 >> 7);
-      uint8_t const payloadType = (b1 & 0x7f);
+  // The RTP timestamp of a frame unwrapped into microseconds since the first
+  // decoded frame.
+  int64_t toMediaTime(uint32_t rtpTimestamp)
+  {
+    if (m_isMediaTimeKnown) {
+      m_mediaTicks += static_cast<int32_t>(rtpTimestamp - m_lastMediaRtpTime);
+    }
+    m_lastMediaRtpTime = rtpTimestamp;
+    m_isMediaTimeKnown = true;
+    return m_mediaTicks * 1000000 / m_clockRate;
+  }
 
-      if (payloadType != 96) {
-        std::cout << "WARNING: Unknown format " << +payloadType << std::endl;
-        return;
+  // Fills the additional outputs that take the frame from the decoded image.
+  // Outputs converted on other workers get a copy, so that they can run while
+  // the next frame is decoded: those cut from a region get a copy of just
+  // their region, the others share one of the whole image. The image is
+  // skipped for an output whose worker is too far behind.
+  void writeOutputs(uint8_t const *y, int32_t yStride, uint8_t const *u,
+      int32_t uStride, uint8_t const *v, int32_t vStride,
+      cluon::data::TimeStamp const &sampleTime)
+  {
+    int32_t const width{static_cast<int32_t>(m_width)};
+    int32_t const height{static_cast<int32_t>(m_height)};
+    int32_t const chromaWidth{(width + 1) / 2};
+    int32_t const chromaSize{chromaWidth * ((height + 1) / 2)};
+
+    std::shared_ptr<std::vector<uint8_t>> copy{nullptr};
+    for (auto &output : m_outputs) {
+      if (!output.isDue) {
+        continue;
       }
-
-      uint16_t b2b3;
-      memcpy(&b2b3, buf_start + 2, 2);
-      uint16_t const sequenceNumber = ntohs(b2b3);
-      
-      uint32_t b4b5b6b7;
-      memcpy(&b4b5b6b7, buf_start + 4, 4);
-      uint32_t const timestamp = ntohl(b4b5b6b7);
-      
-      uint32_t b8b9b10b11;
-      memcpy(&b8b9b10b11, buf_start + 8, 4);
-      uint32_t const ssrcId = ntohl(b8b9b10b11);
-
-      uint32_t paddingLen = 0;
-      if (hasPadding) {
-        paddingLen = *(buf_start + data.length() - 1);
+      if (output.isInline) {
+        output.image->write(y, yStride, u, uStride, v, vStride, sampleTime);
+        continue;
+      }
+      ImageOutput *image = output.image.get();
+      OutputSpec const &spec{image->spec()};
+      if (spec.cropWidth != m_width || spec.cropHeight != m_height) {
+        int32_t const cropX{static_cast<int32_t>(spec.cropX)};
+        int32_t const cropY{static_cast<int32_t>(spec.cropY)};
+        int32_t const regionWidth{static_cast<int32_t>(spec.cropWidth)};
+        int32_t const regionHeight{static_cast<int32_t>(spec.cropHeight)};
+        int32_t const regionChromaWidth{(regionWidth + 1) / 2};
+        int32_t const regionLumaSize{regionWidth * regionHeight};
+        int32_t const regionChromaSize{regionChromaWidth
+          * ((regionHeight + 1) / 2)};
+        std::shared_ptr<std::vector<uint8_t>> regionCopy{acquireFrameCopy()};
+        uint8_t *data = regionCopy->data();
+        libyuv::I420Copy(y + cropY * yStride + cropX, yStride,
+            u + (cropY / 2) * uStride + cropX / 2, uStride,
+            v + (cropY / 2) * vStride + cropX / 2, vStride,
+            data, regionWidth, data + regionLumaSize, regionChromaWidth,
+            data + regionLumaSize + regionChromaSize, regionChromaWidth,
+            regionWidth, regionHeight);
+        output.queue.post([image, regionCopy, regionWidth, regionChromaWidth,
+            regionLumaSize, regionChromaSize, sampleTime]() {
+            uint8_t const *region = regionCopy->data();
+            image->writeRegion(region, regionWidth, region + regionLumaSize,
+                regionChromaWidth, region + regionLumaSize + regionChromaSize,
+                regionChromaWidth, sampleTime);
+          });
+        continue;
       }
+      if (!copy) {
+        copy = acquireFrameCopy();
+        uint8_t *data = copy->data();
+        libyuv::I420Copy(y, yStride, u, uStride, v, vStride, data, width,
+            data + width * height, chromaWidth,
+            data + width * height + chromaSize, chromaWidth, width, height);
+      }
+      output.queue.post([image, copy, width, height, chromaWidth, chromaSize,
+          sampleTime]() {
+          uint8_t const *data = copy->data();
+          image->write(data, width, data + width * height, chromaWidth,
+              data + width * height + chromaSize, chromaWidth, sampleTime);
+        });
+    }
+  }
 
-      uint8_t const b12 = *(buf_start + 12);
-      uint8_t const h264RtpF = b12 >> 7;
-      if (h264RtpF) {
-        std::cerr << "Unexpected H264 RTP header, F=1." << std::endl;
-        return;
+  // Reuses a copy no job refers to any more, to keep the allocations out of
+  // the decode path.
+  std::shared_ptr<std::vector<uint8_t>> acquireFrameCopy()
+  {
+    for (auto const &copy : m_frameCopies) {
+      if (1 == copy.use_count()) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return copy;
       }
-      uint8_t const h264RtpNri = (b12 & 0x60) >> 5;
-      uint8_t const h264RtpType = (b12 & 0x1f);
-      uint8_t nalType;
+    }
+    m_frameCopies.push_back(std::make_shared<std::vector<uint8_t>>(
+          imageSize(PixelFormat::I420, m_width, m_height)));
+    return m_frameCopies.back();
+  }
 
-      cluon::data::TimeStamp ts;
-      {
-        std::lock_guard<std::mutex> lock(rtcpMutex);
-        uint64_t rtpTimeInMicroseconds = (timestamp - latestRtpTime)
-          * (1000000UL / sdpData.clockrate[payloadType]);
-        ts = cluon::time::fromMicroseconds(
-            cluon::time::toMicroseconds(latestNtpTime)
-            + rtpTimeInMicroseconds);
-        highestSeq = sequenceNumber > highestSeq ? sequenceNumber : highestSeq;
-      }
-
-      auto decodeFrame = [&verbose, NAME_ARGB, NAME_I420, &width, &height,
-	   &display, &visual, &window, &ximage, &sharedMemoryARGB,
-           &sharedMemoryI420, &decoder](const std::string &outData){
-        if (!sharedMemoryARGB) {
-          std::clog << "[opendlv-device-camera-rtp]: Created shared memory " << NAME_ARGB << " (" << (width * height * 4) << " bytes) for an ARGB image (width = " << width << ", height = " << height << ")." << std::endl;
-          sharedMemoryARGB.reset(new cluon::SharedMemory{NAME_ARGB, width * height * 4});
-          if (verbose) {
-            display = XOpenDisplay(NULL);
-            visual = DefaultVisual(display, 0);
-            window = XCreateSimpleWindow(display, RootWindow(display, 0), 0, 0, width, height, 1, 0, 0);
-            ximage = XCreateImage(display, visual, 24, ZPixmap, 0, reinterpret_cast<char*>(sharedMemoryARGB->data()), width, height, 32, 0);
-            XMapWindow(display, window);
-          }
+  // Selects the configured video track of the session, or the first one
+  // with a supported format, and the first format of the track, in the
+  // camera's order of preference, that can be depacketized.
+  bool selectTrack(SdpData const &sdpData)
+  {
+    int32_t track{-1};
+    for (auto const &media : sdpData.media) {
+      if ("video" != media.type) {
+        continue;
+      }
+      track++;
+      if (m_config.track >= 0 && track != m_config.track) {
+        continue;
+      }
+      for (uint32_t payloadType : media.payloadTypes) {
+        auto const encoding = media.encoding.find(payloadType);
+        if (payloadType >= m_payloadFormats.size()
+            || encoding == media.encoding.end()) {
+          continue;
         }
-        if (!sharedMemoryI420) {
-          std::clog << "[opendlv-device-camera-rtp]: Created shared memory " << NAME_I420 << " (" << (width * height * 3/2) << " bytes) for an I420 image (width = " << width << ", height = " << height << ")." << std::endl;
-          sharedMemoryI420.reset(new cluon::SharedMemory{NAME_I420, width * height * 3/2});
+        if ("H264" == encoding->second) {
+          m_codec = Codec::H264;
+        } else if ("H265" == encoding->second) {
+          m_codec = Codec::H265;
+        } else if ("JPEG" == encoding->second) {
+          m_codec = Codec::MJPEG;
+        } else {
+          continue;
         }
-	if (sharedMemoryARGB && sharedMemoryI420) {
-          uint8_t* yuvData[3];
+        m_media = media;
+        m_payloadType = payloadType;
+        return true;
+      }
+    }
+    if (m_config.track > track) {
+      std::cerr << "[opendlv-device-camera-rtp]: The session of "
+        << m_config.name << " has no video track " << m_config.track
+        << " (" << (track + 1) << " video tracks)." << std::endl;
+    } else {
+      std::cerr << "[opendlv-device-camera-rtp]: No supported video format "
+        << "(H264, H265 or JPEG) in the session description of "
+        << m_config.name << "." << std::endl;
+    }
+    return false;
+  }
 
-          SBufferInfo bufferInfo;
-          memset(&bufferInfo, 0, sizeof (SBufferInfo));
+  // Decompresses a JPEG image straight into the I420 shared memory, from
+  // which the ARGB image is converted. As no other image refers to it, an
+  // image no output takes is not decompressed at all.
+  void decodeJpegFrame(std::string const &frame,
+      std::chrono::system_clock::time_point const &received, bool isAnyDue)
+  {
+#ifdef HAVE_JPEG
+    if (!isAnyDue) {
+      return;
+    }
+    // The chroma planes round odd sizes up, as imageSize does.
+    uint32_t const uvStride{(m_width + 1) / 2};
+    uint8_t *i420 = reinterpret_cast<uint8_t*>(m_sharedMemoryI420->data());
+    uint8_t *u = i420 + m_width * m_height;
+    uint8_t *v = u + uvStride * ((m_height + 1) / 2);
+
+    m_sharedMemoryI420->lock();
+    int32_t const result{libyuv::MJPGToI420(
+        reinterpret_cast<uint8_t const *>(frame.data()), frame.size(),
+        i420, m_width, u, uvStride, v, uvStride,
+        m_width, m_height, m_width, m_height)};
+    m_sharedMemoryI420->unlock();
+    if (0 != result) {
+      std::cerr << "JPEG decoding for current frame failed." << std::endl;
+      return;
+    }
 
-          const uint32_t LEN{static_cast<uint32_t>(outData.size())};
+    cluon::data::TimeStamp const sampleTime{cluon::time::now()};
+    if (m_isArgbDue) {
+      m_sharedMemoryARGB->lock();
+      m_sharedMemoryARGB->setTimeStamp(sampleTime);
+      libyuv::I420ToARGB(i420, m_width, u, uvStride, v, uvStride, reinterpret_cast<uint8_t*>(m_sharedMemoryARGB->data()), m_width * 4, m_width, m_height);
+      m_sharedMemoryARGB->unlock();
+      m_sharedMemoryARGB->notifyAll();
+    }
+    if (m_isI420Due) {
+      m_sharedMemoryI420->lock();
+      m_sharedMemoryI420->setTimeStamp(sampleTime);
+      m_sharedMemoryI420->unlock();
+      m_sharedMemoryI420->notifyAll();
+    }
 
-          if (0 != decoder->DecodeFrame2(reinterpret_cast<const unsigned char*>(outData.c_str()), LEN, yuvData, &bufferInfo)) {
-            std::cerr << "H264 decoding for current frame failed." << std::endl;
-          }
-          else {
-            if (1 == bufferInfo.iBufferStatus) {
-              sharedMemoryARGB->lock();
-              sharedMemoryARGB->setTimeStamp(cluon::time::now());
-              {
-                libyuv::I420ToARGB(yuvData[0], bufferInfo.UsrData.sSystemBuffer.iStride[0], yuvData[1], bufferInfo.UsrData.sSystemBuffer.iStride[1], yuvData[2], bufferInfo.UsrData.sSystemBuffer.iStride[1], reinterpret_cast<uint8_t*>(sharedMemoryARGB->data()), width * 4, width, height);
-                if (verbose) {
-                  XPutImage(display, window, DefaultGC(display, 0), ximage, 0, 0, 0, 0, width, height);
-                }
-              }
-              sharedMemoryARGB->unlock();
+    writeOutputs(i420, m_width, u, uvStride, v, uvStride, sampleTime);
 
-	      sharedMemoryI420->lock();
-              {
-                memcpy(reinterpret_cast<uint8_t*>(sharedMemoryI420->data()), yuvData[0], bufferInfo.UsrData.sSystemBuffer.iStride[0]);
-                memcpy(reinterpret_cast<uint8_t*>(sharedMemoryI420->data() + (width * height)), yuvData[1], bufferInfo.UsrData.sSystemBuffer.iStride[1]);
-                memcpy(reinterpret_cast<uint8_t*>(sharedMemoryI420->data() + (width * height + ((width * height) >> 2))), yuvData[2], bufferInfo.UsrData.sSystemBuffer.iStride[2]);
-              }
-              sharedMemoryI420->unlock();
-              sharedMemoryI420->notifyAll();
-              sharedMemoryARGB->notifyAll();
-            }
-          }
-        }
-      };
+    if (m_config.isMeasuringLatency && !m_isReplaying) {
+      measureLatency(received);
+    }
+#else
+    (void) frame;
+    (void) received;
+    (void) isAnyDue;
+#endif
+  }
 
-      if (h264RtpType >= 1 && h264RtpType <= 23) {
-        nalType = h264RtpType;
-        uint32_t nalLen = data.length() - 12 - paddingLen;
-        outData = std::string(reinterpret_cast<const char*>(&nalPrefix[0]), 4) 
-            + std::string(buf_start + 12, nalLen);
+  // The time from the kernel receiving the last packet of an access unit to
+  // its image being in the shared memory, summarised every LATENCY_WINDOW
+  // frames.
+  void measureLatency(std::chrono::system_clock::time_point const &received)
+  {
+    m_latencies.push_back(std::chrono::duration<double, std::milli>(
+          std::chrono::system_clock::now() - received).count());
+    if (m_latencies.size() < LATENCY_WINDOW) {
+      return;
+    }
+    std::sort(m_latencies.begin(), m_latencies.end());
+    std::cout << "[opendlv-device-camera-rtp]: Packet to shared memory latency "
+      << "of " << m_config.name << " over " << m_latencies.size()
+      << " frames: median " << m_latencies[m_latencies.size() / 2]
+      << " ms, 99th percentile " << m_latencies[m_latencies.size() * 99 / 100]
+      << " ms, max " << m_latencies.back() << " ms." << std::endl;
+    m_latencies.clear();
+  }
 
-        if (verbose) {
-          std::cout << "Received " << outData.size() << " bytes." << std::endl;
-        }
+  // Decodes every frame, as later ones refer to it, but only converts and
+  // publishes it for the outputs whose rate it is due for.
+  void decodeFrame(std::string const &frame,
+      std::chrono::system_clock::time_point const &received, int64_t mediaTime)
+  {
+    bool const isAnyDue{selectOutputs(mediaTime)};
+    if (Codec::MJPEG == m_codec) {
+      decodeJpegFrame(frame, received, isAnyDue);
+      return;
+    }
+    if (m_sharedMemoryARGB && m_sharedMemoryI420) {
+      uint8_t* yuvData[3];
 
-        decodeFrame(outData);
+      SBufferInfo bufferInfo;
+      memset(&bufferInfo, 0, sizeof (SBufferInfo));
 
-        opendlv::proxy::ImageReading ir;
-        ir.fourcc("h264").width(width).height(height).data(outData);
+      const uint32_t LEN{static_cast<uint32_t>(frame.size())};
 
-        std::lock_guard<std::mutex> lck(recFileMutex);
-        if (recFile && recFile->good()) {
-          cluon::data::Envelope envelope;
-          {
-            cluon::ToProtoVisitor protoEncoder;
+      if (0 != m_decoder->DecodeFrame2(reinterpret_cast<const unsigned char*>(frame.c_str()), LEN, yuvData, &bufferInfo)) {
+        std::cerr << "H264 decoding for current frame failed." << std::endl;
+      }
+      else {
+        uint32_t const decodedWidth{static_cast<uint32_t>(bufferInfo.UsrData.sSystemBuffer.iWidth)};
+        uint32_t const decodedHeight{static_cast<uint32_t>(bufferInfo.UsrData.sSystemBuffer.iHeight)};
+        if (1 == bufferInfo.iBufferStatus
+            && (decodedWidth != m_width || decodedHeight != m_height)) {
+          if (!m_isSizeMismatchReported) {
+            std::cerr << "[opendlv-device-camera-rtp]: Decoded image of "
+              << decodedWidth << "x" << decodedHeight << " does not fit the "
+              << "shared memory of " << m_config.name << " (" << m_width
+              << "x" << m_height << "), skipping." << std::endl;
+            m_isSizeMismatchReported = true;
+          }
+        } else if (1 == bufferInfo.iBufferStatus && isAnyDue) {
+          // The planes are already cropped to the frame cropping of the SPS.
+          int32_t const yStride{bufferInfo.UsrData.sSystemBuffer.iStride[0]};
+          int32_t const uvStride{bufferInfo.UsrData.sSystemBuffer.iStride[1]};
+          cluon::data::TimeStamp const sampleTime{cluon::time::now()};
+          if (m_isArgbDue) {
+            m_sharedMemoryARGB->lock();
+            m_sharedMemoryARGB->setTimeStamp(sampleTime);
+            libyuv::I420ToARGB(yuvData[0], yStride, yuvData[1], uvStride, yuvData[2], uvStride, reinterpret_cast<uint8_t*>(m_sharedMemoryARGB->data()), m_width * 4, m_width, m_height);
+            m_sharedMemoryARGB->unlock();
+            m_sharedMemoryARGB->notifyAll();
+          }
+
+          if (m_isI420Due) {
+            m_sharedMemoryI420->lock();
+            m_sharedMemoryI420->setTimeStamp(sampleTime);
             {
-              envelope.dataType(ir.ID());
-              ir.accept(protoEncoder);
-              envelope.serializedData(protoEncoder.encodedData());
-              envelope.sent(cluon::time::now());
-              envelope.sampleTimeStamp(cluon::time::now());
-              envelope.senderStamp(senderStamp);
+              uint32_t const chromaWidth{(m_width + 1) / 2};
+              uint8_t *i420 = reinterpret_cast<uint8_t*>(m_sharedMemoryI420->data());
+              uint8_t *u = i420 + m_width * m_height;
+              uint8_t *v = u + chromaWidth * ((m_height + 1) / 2);
+              libyuv::I420Copy(yuvData[0], yStride, yuvData[1], uvStride, yuvData[2], uvStride, i420, m_width, u, chromaWidth, v, chromaWidth, m_width, m_height);
             }
+            m_sharedMemoryI420->unlock();
+            m_sharedMemoryI420->notifyAll();
           }
 
-          std::string serializedData{cluon::serializeEnvelope(std::move(envelope))};
-          recFile->write(serializedData.data(), serializedData.size());
-          recFile->flush();
-        }
+          writeOutputs(yuvData[0], yStride, yuvData[1], uvStride, yuvData[2],
+              uvStride, sampleTime);
 
-        outData = "";
-
-      } else if (h264RtpType == 28) {
-        uint8_t b13 = *(buf_start + 13);
-        bool isStartFragment = b13 >> 7;
-        bool isEndFragment = (b13 & 0x40) >> 6;
-        nalType = (b13 & 0x1f);
-
-        std::string extra;
-        if (isStartFragment) {
-          uint8_t nalHeader = (h264RtpNri << 5) | nalType;
-          extra = std::string(reinterpret_cast<const char*>(&nalPrefix[0]), 4) 
-            + sdpData.sps[payloadType] 
-            + std::string(reinterpret_cast<const char*>(&nalPrefix[0]), 4) 
-            + sdpData.pps[payloadType]
-            + std::string(reinterpret_cast<const char*>(&nalPrefix[0]), 4)
-            + static_cast<char>(nalHeader);
+          if (m_config.isMeasuringLatency && !m_isReplaying) {
+            measureLatency(received);
+          }
         }
+      }
+    }
+  }
 
-        uint32_t nalLen = data.length() - 14 - paddingLen;
-        outData += extra + std::string(buf_start + 14, nalLen);
+  void recordFrame(std::shared_ptr<std::string const> const &frame,
+      uint32_t rtpTimestamp, bool isKeyframe)
+  {
+    RecordedFrame recordedFrame;
+    recordedFrame.data = frame;
+    recordedFrame.fourcc = (Codec::MJPEG == m_codec) ? "MJPG" :
+      ((Codec::H265 == m_codec) ? "h265" : "h264");
+    recordedFrame.width = m_width;
+    recordedFrame.height = m_height;
+    recordedFrame.senderStamp = m_config.senderStamp;
+    recordedFrame.sampleTimeStamp = cluon::time::now();
+    recordedFrame.rtpTimestamp = rtpTimestamp;
+    recordedFrame.isKeyframe = isKeyframe;
+    m_recorder.writeFrame(recordedFrame);
+  }
 
-        if (isEndFragment) {
-          if (verbose) {
-            std::cout << "Received " << outData.size() << " bytes (defragmented)." << std::endl;
-          }
+  // Tells whether the access unit should be decoded. On demand, decoding
+  // stops while nobody is attached to the shared memory and resumes at the
+  // next keyframe once a consumer shows up, so that the decoder never sees
+  // frames referring to pictures it skipped.
+  bool shouldDecode(bool isKeyframe)
+  {
+    if (DecodeMode::NEVER == m_config.decodeMode || !m_canDecode) {
+      return false;
+    }
+    if (DecodeMode::ALWAYS == m_config.decodeMode) {
+      return true;
+    }
 
-          decodeFrame(outData);
+    auto const now = std::chrono::steady_clock::now();
+    if (now - m_lastConsumerCheck > std::chrono::milliseconds(500)) {
+      m_lastConsumerCheck = now;
+      int32_t const argbConsumers{
+        countSharedMemoryConsumers(*m_sharedMemoryARGB)};
+      int32_t const i420Consumers{
+        countSharedMemoryConsumers(*m_sharedMemoryI420)};
+      // An unknown count (-1) keeps decoding enabled.
+      m_hasConsumers = (0 != argbConsumers) || (0 != i420Consumers);
+      for (auto &output : m_outputs) {
+        m_hasConsumers |= (0 != countSharedMemoryConsumers(
+              output.image->sharedMemory()));
+      }
+    }
 
-          opendlv::proxy::ImageReading ir;
-          ir.fourcc("h264").width(width).height(height).data(outData);
-          std::lock_guard<std::mutex> lck(recFileMutex);
-          if (recFile && recFile->good()) {
-            cluon::data::Envelope envelope;
-            {
-              cluon::ToProtoVisitor protoEncoder;
-              {
-                envelope.dataType(ir.ID());
-                ir.accept(protoEncoder);
-                envelope.serializedData(protoEncoder.encodedData());
-                envelope.sent(cluon::time::now());
-                envelope.sampleTimeStamp(cluon::time::now());
-                envelope.senderStamp(senderStamp);
-              }
-            }
+    if (!m_hasConsumers) {
+      if (m_isDecoding && m_verbose) {
+        std::cout << "No consumer attached to " << m_config.name
+          << ", pausing decoding." << std::endl;
+      }
+      m_isDecoding = false;
+    } else if (!m_isDecoding && isKeyframe) {
+      if (m_verbose) {
+        std::cout << "Consumer attached to " << m_config.name
+          << ", resuming decoding." << std::endl;
+      }
+      m_isDecoding = true;
+    }
+    return m_isDecoding;
+  }
 
-            std::string serializedData{cluon::serializeEnvelope(std::move(envelope))};
-            recFile->write(serializedData.data(), serializedData.size());
-            recFile->flush();
-          }
+  // How far, in media time according to the RTP timestamps, the frame about
+  // to be posted is ahead of the last one the worker finished decoding.
+  int64_t decodeLagInMicroseconds(uint32_t rtpTimestamp)
+  {
+    if (!m_isLagKnown) {
+      m_decodedRtpTime.store(rtpTimestamp, std::memory_order_relaxed);
+      m_isLagKnown = true;
+      return 0;
+    }
+    int32_t const lag{static_cast<int32_t>(rtpTimestamp
+          - m_decodedRtpTime.load(std::memory_order_relaxed))};
+    return (lag > 0) ? static_cast<int64_t>(lag) * 1000000 / m_clockRate : 0;
+  }
 
-          outData = "";
-        }
-      } else {
-        std::cout << "WARNING: unknown RTP H264 payload type: " << h264RtpType
-          << std::endl;
+  // Tells whether the frame should be dropped to bound the decoder's lag.
+  bool isOverloaded(uint32_t rtpTimestamp, bool isReference)
+  {
+    if (0 == m_config.maxDecodeLagInMicroseconds || 0 == m_clockRate
+        || m_isReplaying) {
+      return false;
+    }
+    int64_t const lag{decodeLagInMicroseconds(rtpTimestamp)};
+    if (lag <= m_config.maxDecodeLagInMicroseconds) {
+      m_isOverloaded = false;
+      return false;
+    }
+    if (OverloadPolicy::NON_REFERENCE == m_config.overloadPolicy
+        && isReference) {
+      return false;
+    }
+    if (!m_isOverloaded) {
+      std::cerr << "[opendlv-device-camera-rtp]: Decoding of " << m_config.name
+        << " lags " << lag / 1000 << " ms behind, dropping "
+        << ((OverloadPolicy::GOP == m_config.overloadPolicy) ?
+            "frames up to the next keyframe." : "non-reference frames.")
+        << std::endl;
+      m_isOverloaded = true;
+    }
+    return true;
+  }
+
+  // Hands the parameter sets of a dropped access unit to the decoder, as the
+  // following access units may refer to them.
+  void decodeParameterSets(std::string &&parameterSets)
+  {
+    if (parameterSets.empty() || nullptr == m_decoder) {
+      return;
+    }
+    std::shared_ptr<std::string const> data{
+      std::make_shared<std::string const>(std::move(parameterSets))};
+    WorkerPool::Job job{[this, data]() {
+        uint8_t *yuvData[3];
+        SBufferInfo bufferInfo;
+        memset(&bufferInfo, 0, sizeof(SBufferInfo));
+        m_decoder->DecodeFrame2(
+            reinterpret_cast<unsigned char const *>(data->data()),
+            static_cast<int32_t>(data->size()), yuvData, &bufferInfo);
+      }};
+    while (!m_decodeQueue.post(std::move(job))) {
+      if (!m_isReplaying) {
+        // Every keyframe carries the parameter sets it needs.
+        m_isWaitingForKeyframe = true;
+        return;
       }
-    };
+      std::this_thread::yield();
+    }
+  }
+
+  // Records the complete access unit and hands it over to the worker; both
+  // share the same buffer. Access units are dropped as a whole, but never the
+  // parameter sets they carry.
+  void onFrame(uint32_t rtpTimestamp, bool isKeyframe, bool isReference,
+      std::string &&parameterSets,
+      std::chrono::system_clock::time_point const &received)
+  {
+    std::shared_ptr<std::string const> frame{
+      std::make_shared<std::string const>(std::move(m_outData))};
+    m_outData = "";
+
+    recordFrame(frame, rtpTimestamp, isKeyframe);
+
+    if (!shouldDecode(isKeyframe)) {
+      m_isLagKnown = false;
+      return;
+    }
+    if (m_isWaitingForKeyframe) {
+      if (!isKeyframe) {
+        m_droppedFrames++;
+        decodeParameterSets(std::move(parameterSets));
+        return;
+      }
+      m_isWaitingForKeyframe = false;
+      m_isLagKnown = false;
+    }
+    if ((!isKeyframe || !isReference)
+        && isOverloaded(rtpTimestamp, isReference)) {
+      m_droppedFrames++;
+      m_isWaitingForKeyframe =
+        (OverloadPolicy::GOP == m_config.overloadPolicy);
+      decodeParameterSets(std::move(parameterSets));
+      return;
+    }
+
+    WorkerPool::Job job{[this, frame, rtpTimestamp, received]() {
+        decodeFrame(*frame, received, toMediaTime(rtpTimestamp));
+        m_decodedRtpTime.store(rtpTimestamp, std::memory_order_relaxed);
+      }};
+    if (m_isReplaying) {
+      // A replay must not lose frames, so it waits for the worker instead.
+      while (!m_decodeQueue.post(std::move(job))) {
+        std::this_thread::yield();
+      }
+    } else if (!m_decodeQueue.post(std::move(job))) {
+      // The following frames refer to the dropped one.
+      std::cerr << "[opendlv-device-camera-rtp]: Decoding of " << m_config.name
+        << " falls behind, skipping to the next keyframe." << std::endl;
+      m_isWaitingForKeyframe = true;
+      m_droppedFrames++;
+    }
+  }
+
+  void onStreamData(char const *buf_start, size_t length,
+      std::chrono::system_clock::time_point const &received) noexcept
+  {
+    if (length < 14) {
+      return;
+    }
+
+    uint8_t const b0 = *buf_start;
+   // uint8_t const version = (b0 >> 6);
+    bool const hasPadding = (b0 & 0x20) >> 5;
+   // bool const hasExtension = (b0 & 0x10) >> 4;
+   // uint8_t const csrcCount = (b0 & 0xf);
     
-    auto onControlData = [&clientPortB, &serverPortB, &clientSsrc, &hostname, 
-         &rtcpMutex, &latestNtpTime, &latestRtpTime, &jitter, &highestSeq,
-         &verbose](
-             std::string &&_data, std::string &&, 
-             std::chrono::system_clock::time_point &&dataInTs) noexcept {
+    uint8_t const b1 = *(buf_start + 1);
+    bool const isMarker = (b1 >> 7);
+    uint8_t const payloadType = (b1 & 0x7f);
 
-      char const *buf_start = static_cast<char const *>(_data.c_str());
+    PayloadFormat const &format{m_payloadFormats[payloadType]};
+    if (nullptr == format.depacketize) {
+      if (!m_isPayloadTypeReported[payloadType]) {
+        std::cout << "WARNING: Unknown format " << +payloadType << std::endl;
+        m_isPayloadTypeReported[payloadType] = true;
+      }
+      return;
+    }
 
-    //  uint8_t const b0 = *buf_start;
-    //  uint8_t const version = (b0 >> 6);
-    //  bool const hasPadding = (b0 & 0x20) >> 5;
-    //  uint8_t const receptionReportCount = (b0 & 0x1f);
+    uint16_t b2b3;
+    memcpy(&b2b3, buf_start + 2, 2);
+    uint16_t const sequenceNumber = ntohs(b2b3);
+    
+    uint32_t b4b5b6b7;
+    memcpy(&b4b5b6b7, buf_start + 4, 4);
+    uint32_t const timestamp = ntohl(b4b5b6b7);
+    
+    uint32_t b8b9b10b11;
+    memcpy(&b8b9b10b11, buf_start + 8, 4);
+    uint32_t const ssrcId = ntohl(b8b9b10b11);
+
+    uint32_t paddingLen = 0;
+    if (hasPadding) {
+      paddingLen = static_cast<uint8_t>(*(buf_start + length - 1));
+      if (12 + paddingLen > length) {
+        return;
+      }
+    }
 
-      uint8_t const b1 = *(buf_start + 1);
-      uint8_t const packetType = b1;
-      
-    //  uint16_t b2b3;
-    //  memcpy(&b2b3, buf_start + 2, 2);
-    //  uint8_t const length = ntohs(b2b3);
+    cluon::data::TimeStamp ts;
+    {
+      std::lock_guard<std::mutex> lock(m_rtcpMutex);
+      uint64_t rtpTimeInMicroseconds = (timestamp - m_latestRtpTime)
+        * (1000000UL / format.clockRate);
+      ts = cluon::time::fromMicroseconds(
+          cluon::time::toMicroseconds(m_latestNtpTime)
+          + rtpTimeInMicroseconds);
+      m_highestSeq = sequenceNumber > m_highestSeq ? sequenceNumber
+        : m_highestSeq;
+
+      // Interarrival jitter in RTP time units as in RFC 3550, A.8.
+      if (std::chrono::system_clock::time_point{} != m_lastArrival) {
+        double const arrivalDelta{std::chrono::duration<double>(
+            received - m_lastArrival).count() * format.clockRate};
+        double const transitDelta{arrivalDelta
+          - static_cast<int32_t>(timestamp - m_lastRtpTime)};
+        m_jitter += (std::fabs(transitDelta) - m_jitter) / 16.0;
+      }
+      m_lastArrival = received;
+      m_lastRtpTime = timestamp;
+    }
+
+    (this->*format.depacketize)(reinterpret_cast<uint8_t const *>(buf_start)
+        + 12, length - 12 - paddingLen, timestamp, isMarker, received);
+  }
+
+  void depacketizeH264(uint8_t const *payload, size_t length,
+      uint32_t timestamp, bool isMarker,
+      std::chrono::system_clock::time_point const &received)
+  {
+    m_packetReceived = received;
+    m_h264Depacketizer->push(payload, length, timestamp, isMarker);
+  }
+
+  void depacketizeH265(uint8_t const *payload, size_t length,
+      uint32_t timestamp, bool isMarker,
+      std::chrono::system_clock::time_point const &received)
+  {
+    m_packetReceived = received;
+    m_hevcDepacketizer->push(payload, length, timestamp, isMarker);
+  }
+
+  void depacketizeMjpeg(uint8_t const *payload, size_t length,
+      uint32_t timestamp, bool isMarker,
+      std::chrono::system_clock::time_point const &received)
+  {
+    m_packetReceived = received;
+    m_mjpegDepacketizer->push(payload, length, timestamp, isMarker);
+  }
+
+  void onControlData(char const *buf_start, size_t size,
+      std::chrono::system_clock::time_point const &dataInTs) noexcept
+  {
+    if (size < 20) {
+      return;
+    }
+
+  //  uint8_t const b0 = *buf_start;
+  //  uint8_t const version = (b0 >> 6);
+  //  bool const hasPadding = (b0 & 0x20) >> 5;
+  //  uint8_t const receptionReportCount = (b0 & 0x1f);
+
+    uint8_t const b1 = *(buf_start + 1);
+    uint8_t const packetType = b1;
+    
+  //  uint16_t b2b3;
+  //  memcpy(&b2b3, buf_start + 2, 2);
+  //  uint8_t const length = ntohs(b2b3);
 
-      uint32_t b4b5b6b7;
-      memcpy(&b4b5b6b7, buf_start + 4, 4);
-      uint32_t const ssrcId = ntohl(b4b5b6b7);
+    uint32_t b4b5b6b7;
+    memcpy(&b4b5b6b7, buf_start + 4, 4);
+    uint32_t const ssrcId = ntohl(b4b5b6b7);
 
-      if (packetType == 200) {
+    if (packetType == 200) {
 
-        uint32_t b8b9b10b11;
-        memcpy(&b8b9b10b11, buf_start + 8, 4);
-        uint32_t const ntpMsw = ntohl(b8b9b10b11);
+      uint32_t b8b9b10b11;
+      memcpy(&b8b9b10b11, buf_start + 8, 4);
+      uint32_t const ntpMsw = ntohl(b8b9b10b11);
+    
+      uint32_t b12b13b14b15;
+      memcpy(&b12b13b14b15, buf_start + 12, 4);
+      uint32_t const ntpLsw = ntohl(b12b13b14b15);
       
-        uint32_t b12b13b14b15;
-        memcpy(&b12b13b14b15, buf_start + 12, 4);
-        uint32_t const ntpLsw = ntohl(b12b13b14b15);
-        
-        uint32_t b10b11b12b13;
-        memcpy(&b10b11b12b13, buf_start + 10, 4);
+      uint32_t b10b11b12b13;
+      memcpy(&b10b11b12b13, buf_start + 10, 4);
+    
+      uint64_t const sec = ntpMsw - 2208988800ULL;
+      uint64_t const usec = (ntpLsw * 1000000UL) >> 32;
+
+      cluon::data::TimeStamp ntpTime = cluon::time::fromMicroseconds(
+          sec * 1000000UL + usec);
       
-        uint64_t const sec = ntpMsw - 2208988800ULL;
-        uint64_t const usec = (ntpLsw * 1000000UL) >> 32;
+      uint32_t b16b17b18b19;
+      memcpy(&b16b17b18b19, buf_start + 16, 4);
+      uint32_t const rtpTime = ntohl(b16b17b18b19);
 
-        cluon::data::TimeStamp ntpTime = cluon::time::fromMicroseconds(
-            sec * 1000000UL + usec);
+      uint32_t jitter_n;
+      uint16_t highestSeq_n;
+      {
+        std::lock_guard<std::mutex> lock(m_rtcpMutex);
+        m_latestNtpTime = ntpTime;
+        m_latestRtpTime = rtpTime;
+        jitter_n = htonl(static_cast<uint32_t>(m_jitter));
+        highestSeq_n = htons(m_highestSeq);
+      }
+
+
+      // Send Receiver report.
+      if (!m_isReplaying) {
+        int32_t fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+        struct sockaddr_in src;
+        std::memset(&src, 0, sizeof(src));
+        src.sin_family = AF_INET;
+        src.sin_addr.s_addr = htonl(INADDR_ANY);
+        src.sin_port = htons(m_clientPortB); 
+
+        bind(fd, reinterpret_cast<struct sockaddr *>(&src), sizeof(src));
         
-        uint32_t b16b17b18b19;
-        memcpy(&b16b17b18b19, buf_start + 16, 4);
-        uint32_t const rtpTime = ntohl(b16b17b18b19);
+        struct sockaddr_in dst;
+        std::memset(&dst, 0, sizeof(dst));
+        dst.sin_family = AF_INET;
+        dst.sin_addr.s_addr = inet_addr(m_hostname.c_str());
+        dst.sin_port = htons(m_serverPortB);
 
-        uint32_t jitter_n;
-        uint16_t highestSeq_n;
+        uint8_t data[48] = {};
         {
-          std::lock_guard<std::mutex> lock(rtcpMutex);
-          latestNtpTime = ntpTime;
-          latestRtpTime = rtpTime;
-          jitter_n = htonl(static_cast<uint32_t>(jitter));
-          highestSeq_n = htons(highestSeq);
-        }
+          data[0] = 0x81;
+          data[1] = 0xc9;
 
+          uint16_t length{7};
+          uint16_t length_n = htons(length);
+          memcpy(data + 2, &length_n, 2);
 
-        // Send Receiver report.
-        {
-          int32_t fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+          uint32_t clientSsrc_n = htonl(m_clientSsrc);
+          memcpy(data + 4, &clientSsrc_n, 4);
+          
+          memcpy(data + 8, &b4b5b6b7, 4);
 
-          struct sockaddr_in src;
-          std::memset(&src, 0, sizeof(src));
-          src.sin_family = AF_INET;
-          src.sin_addr.s_addr = htonl(INADDR_ANY);
-          src.sin_port = htons(clientPortB); 
+          uint32_t fractionAndCumulativeLost{0};
+          uint32_t fractionAndCumulativeLost_n 
+            = htonl(fractionAndCumulativeLost);
+          memcpy(data + 12, &fractionAndCumulativeLost_n, 4);
+          
+          uint16_t extendedHighestSeq{1};
+          uint16_t extendedHighestSeq_n = htons(extendedHighestSeq);
+          memcpy(data + 16, &extendedHighestSeq_n, 2);
+          memcpy(data + 18, &highestSeq_n, 2);
+          
+          memcpy(data + 20, &jitter_n, 4);
+          
+          memcpy(data + 24, &b10b11b12b13, 4);
+
+          double timeSinceSr = std::chrono::duration<double>(
+                std::chrono::high_resolution_clock::now() - dataInTs).count();
+          uint32_t delaySinceLastSr = static_cast<uint32_t>(
+              timeSinceSr / 65536);
+          uint32_t delaySinceLastSr_n = htonl(delaySinceLastSr);
+          memcpy(data + 28, &delaySinceLastSr_n, 4);
+        }
 
-          bind(fd, reinterpret_cast<struct sockaddr *>(&src), sizeof(src));
+        {
+          data[32] = 0x81;
+          data[33] = 0xca;
+
+          uint16_t length{3};
+          uint16_t length_n = htons(length);
+          memcpy(data + 34, &length_n, 2);
           
-          struct sockaddr_in dst;
-          std::memset(&dst, 0, sizeof(dst));
-          dst.sin_family = AF_INET;
-          dst.sin_addr.s_addr = inet_addr(hostname.c_str());
-          dst.sin_port = htons(serverPortB);
-
-          uint8_t data[48] = {};
-          {
-            data[0] = 0x81;
-            data[1] = 0xc9;
-
-            uint16_t length{7};
-            uint16_t length_n = htons(length);
-            memcpy(data + 2, &length_n, 2);
-
-            uint32_t clientSsrc_n = htonl(clientSsrc);
-            memcpy(data + 4, &clientSsrc_n, 4);
-            
-            memcpy(data + 8, &b4b5b6b7, 4);
-
-            uint32_t fractionAndCumulativeLost{0};
-            uint32_t fractionAndCumulativeLost_n 
-              = htonl(fractionAndCumulativeLost);
-            memcpy(data + 12, &fractionAndCumulativeLost_n, 4);
-            
-            uint16_t extendedHighestSeq{1};
-            uint16_t extendedHighestSeq_n = htons(extendedHighestSeq);
-            memcpy(data + 16, &extendedHighestSeq_n, 2);
-            memcpy(data + 18, &highestSeq_n, 2);
-            
-            memcpy(data + 20, &jitter_n, 4);
-            
-            memcpy(data + 24, &b10b11b12b13, 4);
-
-            double timeSinceSr = std::chrono::duration<double>(
-                  std::chrono::high_resolution_clock::now() - dataInTs).count();
-            uint32_t delaySinceLastSr = static_cast<uint32_t>(
-                timeSinceSr / 65536);
-            uint32_t delaySinceLastSr_n = htonl(delaySinceLastSr);
-            memcpy(data + 28, &delaySinceLastSr_n, 4);
-          }
+          uint32_t clientSsrc_n = htonl(m_clientSsrc);
+          memcpy(data + 36, &clientSsrc_n, 4);
+          
+          data[40] = 0x01;
+          data[41] = 0x05;
+          data[42] = 0x73;
+          data[43] = 0x68;
+          data[44] = 0x72;
+          data[45] = 0x65;
+          data[46] = 0x77;
+          data[47] = 0x00;
+        }
 
-          {
-            data[32] = 0x81;
-            data[33] = 0xca;
-
-            uint16_t length{3};
-            uint16_t length_n = htons(length);
-            memcpy(data + 34, &length_n, 2);
-            
-            uint32_t clientSsrc_n = htonl(clientSsrc);
-            memcpy(data + 36, &clientSsrc_n, 4);
-            
-            data[40] = 0x01;
-            data[41] = 0x05;
-            data[42] = 0x73;
-            data[43] = 0x68;
-            data[44] = 0x72;
-            data[45] = 0x65;
-            data[46] = 0x77;
-            data[47] = 0x00;
-          }
+        sendto(fd, data, 48, 0, 
+            reinterpret_cast<const struct sockaddr *>(&dst), sizeof(dst));
+
+        shutdown(fd, SHUT_RDWR);
+        close(fd);
+      }
+    }
+  }
 
-          sendto(fd, data, 48, 0, 
-              reinterpret_cast<const struct sockaddr *>(&dst), sizeof(dst));
+  StreamConfig const m_config;
+  bool const m_verbose;
+  Recorder &m_recorder;
+  WorkerPool::Producer m_decodeQueue;
+  PacketRecorder *m_packetRecorder;
+  RtspSession *m_session;
+  std::string const m_nameArgb;
+  std::string const m_nameI420;
+  uint32_t const m_clientPortB;
+  uint32_t const m_serverPortB;
+  std::string const m_hostname;
+  Decimator m_argbDecimator;
+  Decimator m_i420Decimator;
+  uint32_t m_clientSsrc{0};
+
+  bool m_isReplaying{false};
+  SdpMedia m_media{};
+  Codec m_codec{Codec::H264};
+  uint32_t m_payloadType{0};
+  std::array<PayloadFormat, 128> m_payloadFormats{};
+  std::array<bool, 128> m_isPayloadTypeReported{};
+  bool m_canDecode{false};
+  uint32_t m_width{0};
+  uint32_t m_height{0};
+  bool m_isSizeMismatchReported{false};
+  bool m_isArgbDue{true};
+  bool m_isI420Due{true};
+  int64_t m_mediaTicks{0};
+  uint32_t m_lastMediaRtpTime{0};
+  bool m_isMediaTimeKnown{false};
+
+  ISVCDecoder *m_decoder{nullptr};
+  std::unique_ptr<cluon::SharedMemory> m_sharedMemoryARGB{nullptr};
+  std::unique_ptr<cluon::SharedMemory> m_sharedMemoryI420{nullptr};
+  std::vector<Output> m_outputs{};
+  std::vector<std::shared_ptr<std::vector<uint8_t>>> m_frameCopies{};
+  std::unique_ptr<X11Preview> m_preview{nullptr};
+
+  std::string m_outData{};
+  std::unique_ptr<H264Depacketizer> m_h264Depacketizer{nullptr};
+  std::unique_ptr<HevcDepacketizer> m_hevcDepacketizer{nullptr};
+  std::unique_ptr<MjpegDepacketizer> m_mjpegDepacketizer{nullptr};
+  std::chrono::system_clock::time_point m_packetReceived{};
+  std::vector<double> m_latencies{};
+
+  std::chrono::steady_clock::time_point m_lastConsumerCheck{};
+  bool m_hasConsumers{false};
+  bool m_isDecoding{false};
+  bool m_isWaitingForKeyframe{false};
+
+  uint32_t m_clockRate{90000};
+  std::atomic<uint32_t> m_decodedRtpTime{0};
+  bool m_isLagKnown{false};
+  bool m_isOverloaded{false};
+  uint64_t m_droppedFrames{0};
+
+  std::mutex m_rtcpMutex{};
+  cluon::data::TimeStamp m_latestNtpTime{};
+  uint64_t m_latestRtpTime{0};
+  double m_jitter{0.0};
+  uint32_t m_highestSeq{0};
+  std::chrono::system_clock::time_point m_lastArrival{};
+  uint32_t m_lastRtpTime{0};
+
+  std::unique_ptr<RtpReceiver> m_streamReceiver{nullptr};
+  std::unique_ptr<RtpReceiver> m_controlReceiver{nullptr};
+  std::unique_ptr<EventLoop> m_eventLoop{nullptr};
+};
+
+int32_t main(int32_t argc, char **argv)
+{
+  int32_t retCode{1};
+  auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+  if ( ((0 == commandlineArguments.count("url"))
+        && (0 == commandlineArguments.count("replay-rtp"))) ||
+      (0 == commandlineArguments.count("name")) ||
+      (0 == commandlineArguments.count("cid")) ) {
+    std::cerr << argv[0] << " interfaces with the given RTSP/RTP-based camera "
+      << "and sends the compressed frames as OpenDLV messages." << std::endl
+      << "Usage:   " << argv[0] << " --url=<URL> --cid=<CID> --name=<NAME>"
+      << "[--server-port-udp-a=<Port>] [--id=<ID>] "
+      << "[--verbose]" << std::endl
+      << "         --cid:       CID of the OD4Session to receive Envelopes for "
+      << "recording" << std::endl
+      << "         --server-port-udp-a: The first UDP port to use (the second "
+      << "will always be the number after)"
+      << std::endl
+      << "         --id:        ID to use in case of multiple instances of "
+         "running microservices." 
+      << std::endl
+      << "         --name:      name of the shared memory segment for the decoded h264 frame in ARGB/i420 pixel layouts" << std::endl
+      << "         --url:       URL providing an MJPEG stream over http" 
+      << std::endl
+      << "                      --url, --name, --id and the port options may be repeated to run several cameras in one process;" << std::endl
+      << "                      missing ids count up from the first one and missing client ports are spaced by two" << std::endl
+      << "         --track:     video track of the camera to receive, counted from 0 in the session description; default: the first supported one" << std::endl
+      << "                      repeating the same --url with different --track and --name receives several tracks in one RTSP session" << std::endl
+      << "         --workers:   number of threads decoding the streams; default: one per stream up to the number of cores" << std::endl
+      << "         --worker-cpus: cores to pin the decoding threads to, e.g. 2,3 or 2-5" << std::endl
+      << "         --worker-priority: SCHED_FIFO priority (1-99) of the decoding threads; default: not real-time" << std::endl
+      << "         --rtp-cpus:  cores to run the RTP/RTCP receive threads on" << std::endl
+      << "         --rtp-priority: SCHED_FIFO priority (1-99) of the RTP/RTCP receive threads; default: not real-time" << std::endl
+      << "         --rtp-rcvbuf: socket receive buffer per RTP/RTCP port in bytes; default: 26214400" << std::endl
+      << "         --rtp-bitrate: instead of --rtp-rcvbuf, size the receive buffer for this stream bitrate in bit/s..." << std::endl
+      << "         --rtp-jitter-budget: ...and this many milliseconds of stalled reading; default: 200" << std::endl
+      << "         --rtp-busy-poll: keep polling the RTP/RTCP sockets for this many microseconds after the last packet instead of sleeping (SO_BUSY_POLL); use with --rtp-cpus" << std::endl
+      << "         --worker-spin: keep polling for frames for this many microseconds after the last one before a decoding thread sleeps; use with --worker-cpus" << std::endl
+      << "         --max-decode-lag: drop frames while decoding lags more than this many milliseconds behind the camera; default: no limit" << std::endl
+      << "         --overload-policy: non-reference to only drop frames no other frame refers to, or gop to skip to the next keyframe; default: gop" << std::endl
+      << "         --latency-stats: print the latency from receiving the last packet of a frame to its image in the shared memory" << std::endl
+      << "         --rtp-hw-timestamps: use the receive time stamps of the network card (needs hardware time stamping enabled on the interface)" << std::endl
+      << "         --mlockall:  lock all memory pages to avoid page faults on the receive and decode paths" << std::endl
+      << "         --scaled:    additional outputs scaled from the decoded image, e.g. 640x360:argb,1280x720:i420, into the shared memory <name><width>x<height><format>;" << std::endl
+      << "                      formats: argb, i420, nv12, rgb24, bgr24 (byte order) and rgbp (planar R, G, B); a format alone, e.g. nv12, is full size into <name><format>;" << std::endl
+      << "                      repeated like --name; converted on the workers following the stream's own" << std::endl
+      << "         --argb-rate: only convert and publish the ARGB image at up to this many Hz; default: every frame" << std::endl
+      << "         --i420-rate: only publish the I420 image at up to this many Hz; default: every frame" << std::endl
+      << "                      additional outputs take a rate after their format, e.g. 640x360:argb@5" << std::endl
+      << "         --roi:       additional output of a region of the decoded image, x,y,width,height[:format], e.g. 0,400,1920,400, into the shared memory <name>roi<format>; repeated like --name" << std::endl
+      << "         --no-decode: only record the compressed frames; no decoding and no shared memory" << std::endl
+      << "         --decode-on-demand: only decode while a process is attached to the shared memory" << std::endl
+      << "         --verbose:   show further information" << std::endl
+      << "         --preview:   show the decoded images in an X11 window" << std::endl
+      << "         --preview-rate: refresh rate of the preview window in Hz; default: 60" << std::endl
+      << "         --remote:    enable remotely activated recording" << std::endl
+      << "         --rec:       name of the recording file; default: YYYY-MM-DD_HHMMSS.rec" << std::endl
+      << "         --recsuffix: additional suffix to add to the .rec file" << std::endl
+      << "         --rec-max-bytes: start a new .rec file at the next keyframe once this size is reached; the space is preallocated" << std::endl
+      << "         --rec-max-seconds: start a new .rec file at the next keyframe once this duration is reached" << std::endl
+      << "         --rec-direct-io: write .rec files with O_DIRECT in the background to keep them out of the page cache" << std::endl
+      << "         --pre-record: with --remote, seconds of frames before the RecorderCommand to put into the new .rec file; default: 0" << std::endl
+      << "         --pre-record-bytes: upper bound of the pre-record buffer per stream in bytes; default: 67108864" << std::endl
+      << "         --rtp-dump:  file to store every received RTP/RTCP packet in, with its receive time stamp" << std::endl
+      << "         --replay-rtp: feed the packets of an --rtp-dump file into the streams (selected by --id) instead of using cameras" << std::endl
+      << "Example: " << argv[0] << " --url=rtsp://10.42.42.128/axis-media/media.amp?camera=1 --cid=102 --id=0 --client-port-udp-a=35000 --remote --recsuffix=-rtp" << std::endl;
+  } else {
+    std::vector<std::string> const urls{getRepeatedArgument(argc, argv, "url")};
+    std::vector<std::string> const names{
+      getRepeatedArgument(argc, argv, "name")};
+    std::vector<std::string> const ids{getRepeatedArgument(argc, argv, "id")};
+    std::vector<std::string> const clientPorts{
+      getRepeatedArgument(argc, argv, "client-port-udp-a")};
+    std::vector<std::string> const serverPorts{
+      getRepeatedArgument(argc, argv, "server-port-udp-a")};
+    std::vector<std::string> const tracks{
+      getRepeatedArgument(argc, argv, "track")};
+    std::vector<std::string> const scaled{
+      getRepeatedArgument(argc, argv, "scaled")};
+    std::vector<std::string> const rois{getRepeatedArgument(argc, argv, "roi")};
+    const std::string REPLAY{commandlineArguments["replay-rtp"]};
+    if (REPLAY.empty() && urls.size() != names.size()) {
+      std::cerr << argv[0] << ": Each --url needs its own --name." << std::endl;
+      return retCode;
+    }
+    bool verbose{commandlineArguments.count("verbose") != 0};
+    DecodeMode const decodeMode{
+      (commandlineArguments.count("no-decode") != 0) ? DecodeMode::NEVER :
+      ((commandlineArguments.count("decode-on-demand") != 0) ?
+       DecodeMode::ON_DEMAND : DecodeMode::ALWAYS)};
+
+    int32_t const workers{(commandlineArguments.count("workers") != 0) ?
+      std::stoi(commandlineArguments["workers"]) : 0};
+    if (commandlineArguments.count("workers") != 0 && workers < 1) {
+      std::cerr << argv[0] << ": --workers needs to be at least 1."
+        << std::endl;
+      return retCode;
+    }
+    uint32_t const workerCount{(workers > 0) ? static_cast<uint32_t>(workers) :
+      std::max(1U, std::min(static_cast<uint32_t>(names.size()),
+            std::thread::hardware_concurrency()))};
+    std::vector<int32_t> const workerCpus{
+      parseCpuList(commandlineArguments["worker-cpus"])};
+    int32_t const workerPriority{
+      (commandlineArguments.count("worker-priority") != 0) ?
+        std::stoi(commandlineArguments["worker-priority"]) : 0};
+    std::vector<int32_t> const rtpCpus{
+      parseCpuList(commandlineArguments["rtp-cpus"])};
+    int32_t const rtpPriority{
+      (commandlineArguments.count("rtp-priority") != 0) ?
+        std::stoi(commandlineArguments["rtp-priority"]) : 0};
+    int32_t const busyPollMicroseconds{
+      (commandlineArguments.count("rtp-busy-poll") != 0) ?
+        std::stoi(commandlineArguments["rtp-busy-poll"]) : 0};
+    std::chrono::microseconds const workerSpinTime{
+      (commandlineArguments.count("worker-spin") != 0) ?
+        std::stoi(commandlineArguments["worker-spin"]) : 0};
+
+    // The kernel accounts roughly twice the payload per datagram, so the
+    // buffer for a jitter budget is twice the bytes arriving within it.
+    int32_t receiveBufferSize{26214400};
+    if (commandlineArguments.count("rtp-rcvbuf") != 0) {
+      receiveBufferSize = std::stoi(commandlineArguments["rtp-rcvbuf"]);
+    } else if (commandlineArguments.count("rtp-bitrate") != 0) {
+      double const bitrate{std::stod(commandlineArguments["rtp-bitrate"])};
+      double const jitterBudget{
+        (commandlineArguments.count("rtp-jitter-budget") != 0) ?
+          std::stod(commandlineArguments["rtp-jitter-budget"]) : 200.0};
+      receiveBufferSize = static_cast<int32_t>(
+          2.0 * bitrate / 8.0 * jitterBudget / 1000.0);
+    }
 
-          shutdown(fd, SHUT_RDWR);
-          close(fd);
+    if (commandlineArguments.count("mlockall") != 0) {
+      if (!lockAllMemory()) {
+        std::cerr << "[opendlv-device-camera-rtp]: mlockall failed: "
+          << strerror(errno) << std::endl;
+      }
+    }
+
+    uint32_t const firstId{ids.empty() ? 0 :
+      static_cast<uint32_t>(std::stoi(ids[0]))};
+    uint32_t const firstClientPortA{clientPorts.empty() ? 33000 :
+      static_cast<uint32_t>(std::stoi(clientPorts[0]))};
+    uint32_t const firstServerPortA{serverPorts.empty() ? 50000 :
+      static_cast<uint32_t>(std::stoi(serverPorts[0]))};
+
+    std::vector<StreamConfig> streamConfigs;
+    for (uint32_t i = 0; i < names.size(); ++i) {
+      StreamConfig config;
+      config.url = (i < urls.size()) ? urls[i] : "";
+      config.name = names[i];
+      config.senderStamp = (i < ids.size()) ?
+        static_cast<uint32_t>(std::stoi(ids[i])) : firstId + i;
+      config.clientPortA = (i < clientPorts.size()) ?
+        static_cast<uint32_t>(std::stoi(clientPorts[i])) :
+        firstClientPortA + 2 * i;
+      config.serverPortA = (i < serverPorts.size()) ?
+        static_cast<uint32_t>(std::stoi(serverPorts[i])) : firstServerPortA;
+      config.track = (i < tracks.size()) ? std::stoi(tracks[i]) : -1;
+      config.worker = i % workerCount;
+      config.rtpCpus = rtpCpus;
+      config.rtpPriority = rtpPriority;
+      config.receiveBufferSize = receiveBufferSize;
+      config.isHardwareTimestamping =
+        (commandlineArguments.count("rtp-hw-timestamps") != 0);
+      config.busyPollMicroseconds = busyPollMicroseconds;
+      config.isMeasuringLatency =
+        (commandlineArguments.count("latency-stats") != 0);
+      config.maxDecodeLagInMicroseconds =
+        (commandlineArguments.count("max-decode-lag") != 0) ?
+          static_cast<int64_t>(std::stod(commandlineArguments["max-decode-lag"])
+              * 1000.0) : 0;
+      config.overloadPolicy =
+        ("non-reference" == commandlineArguments["overload-policy"]) ?
+          OverloadPolicy::NON_REFERENCE : OverloadPolicy::GOP;
+      config.decodeMode = decodeMode;
+      config.argbRate = (commandlineArguments.count("argb-rate") != 0) ?
+        std::stod(commandlineArguments["argb-rate"]) : 0.0;
+      config.i420Rate = (commandlineArguments.count("i420-rate") != 0) ?
+        std::stod(commandlineArguments["i420-rate"]) : 0.0;
+      config.isPreviewing = (commandlineArguments.count("preview") != 0);
+      config.previewRate = (commandlineArguments.count("preview-rate") != 0) ?
+        std::stod(commandlineArguments["preview-rate"]) : 60.0;
+      if (i < scaled.size()) {
+        std::istringstream specs(scaled[i]);
+        std::string text;
+        while (std::getline(specs, text, ',')) {
+          OutputSpec spec;
+          if (!parseOutputSpec(text, spec)) {
+            std::cerr << argv[0] << ": Invalid output " << text
+              << ", expected [<width>x<height>:]<format>." << std::endl;
+            return retCode;
+          }
+          config.outputs.push_back(spec);
         }
       }
+      if (i < rois.size()) {
+        OutputSpec spec;
+        if (!parseRoiSpec(rois[i], spec)) {
+          std::cerr << argv[0] << ": Invalid region " << rois[i]
+            << ", expected <x>,<y>,<width>,<height>[:<format>]." << std::endl;
+          return retCode;
+        }
+        config.outputs.push_back(spec);
+      }
+      streamConfigs.push_back(config);
+    }
+
+    auto getYYYYMMDD_HHMMSS = [](){
+      cluon::data::TimeStamp now = cluon::time::now();
+
+      const long int _seconds = now.seconds();
+      struct tm *tm = localtime(&_seconds);
+
+      uint32_t year = (1900 + tm->tm_year);
+      uint32_t month = (1 + tm->tm_mon);
+      uint32_t dayOfMonth = tm->tm_mday;
+      uint32_t hours = tm->tm_hour;
+      uint32_t minutes = tm->tm_min;
+      uint32_t seconds = tm->tm_sec;
+
+      std::stringstream sstr;
+      sstr << year << "-" << ( (month < 10) ? "0" : "" ) << month << "-" << ( (dayOfMonth < 10) ? "0" : "" ) << dayOfMonth
+                     << "_" << ( (hours < 10) ? "0" : "" ) << hours
+                     << ( (minutes < 10) ? "0" : "" ) << minutes
+                     << ( (seconds < 10) ? "0" : "" ) << seconds;
+
+      std::string retVal{sstr.str()};
+      return retVal;
     };
+    const bool REMOTE{commandlineArguments.count("remote") != 0};
+    const std::string REC{(commandlineArguments["rec"].size() != 0) ? commandlineArguments["rec"] : ""};
+    const std::string RECSUFFIX{commandlineArguments["recsuffix"]};
+    const std::string NAME_RECFILE{(REC.size() != 0) ? REC + RECSUFFIX : (getYYYYMMDD_HHMMSS() + RECSUFFIX + ".rec")};
 
-    {
-      cluon::UDPReceiver streamUdpReceiver{localHostname, clientPortA, 
-        onStreamData, serverPortA};
-    
-      cluon::UDPReceiver controlUdpReceiver{localHostname, clientPortB,
-        onControlData, serverPortB};
-
-      uint32_t const heartbeatInterval = 50;
-      uint32_t h = 0;
-      while (od4->isRunning()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-
-        if (h > heartbeatInterval) {
-          curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_OPTIONS);
-          curl_easy_perform(curl);
-          h = 0;
-        } else {
-          h++;
+    std::unique_ptr<cluon::OD4Session> od4{new cluon::OD4Session(static_cast<uint16_t>(std::stoi(commandlineArguments["cid"])))};
+
+    RecorderConfig recorderConfig;
+    recorderConfig.preRecordDurationInMicroseconds =
+      (commandlineArguments.count("pre-record") != 0) ?
+        static_cast<int64_t>(std::stod(commandlineArguments["pre-record"])
+            * 1000000.0) : 0;
+    recorderConfig.preRecordMaxBytes =
+      (commandlineArguments.count("pre-record-bytes") != 0) ?
+        std::stoull(commandlineArguments["pre-record-bytes"]) : 67108864;
+    recorderConfig.maxBytes =
+      (commandlineArguments.count("rec-max-bytes") != 0) ?
+        std::stoull(commandlineArguments["rec-max-bytes"]) : 0;
+    recorderConfig.maxDurationInMicroseconds =
+      (commandlineArguments.count("rec-max-seconds") != 0) ?
+        static_cast<int64_t>(std::stod(commandlineArguments["rec-max-seconds"])
+            * 1000000.0) : 0;
+    recorderConfig.isDirectIo = (commandlineArguments.count("rec-direct-io") != 0);
+
+    Recorder recorder(recorderConfig);
+    if (!REMOTE) {
+      recorder.open(NAME_RECFILE);
+    }
+    else {
+      od4.reset(new cluon::OD4Session(static_cast<uint16_t>(std::stoi(commandlineArguments["cid"])),
+          [REC, RECSUFFIX, getYYYYMMDD_HHMMSS, &recorder](cluon::data::Envelope &&envelope) noexcept {
+        if (cluon::data::RecorderCommand::ID() == envelope.dataType()) {
+          cluon::data::RecorderCommand rc = cluon::extractMessage<cluon::data::RecorderCommand>(std::move(envelope));
+          if (1 == rc.command()) {
+            recorder.open((REC.size() != 0) ? REC + RECSUFFIX : (getYYYYMMDD_HHMMSS() + RECSUFFIX + ".rec"));
+          }
+          else if (2 == rc.command()) {
+            recorder.close();
+          }
+        }
+        else {
+          recorder.write(std::move(envelope));
         }
+      }));
+    }
+
+    std::unique_ptr<PacketRecorder> packetRecorder{nullptr};
+    if (REPLAY.empty() && commandlineArguments.count("rtp-dump") != 0) {
+      packetRecorder.reset(
+          new PacketRecorder(commandlineArguments["rtp-dump"]));
+    }
+
+    // Streams of the same URL are tracks of one RTSP session. The pool is
+    // declared after them, so that on every return its workers are stopped
+    // before the streams their jobs refer to are destroyed.
+    std::map<std::string, std::unique_ptr<RtspSession>> sessions;
+    std::vector<std::unique_ptr<RtpStream>> streams;
+    WorkerPool workerPool(workerCount, workerCpus, workerPriority,
+        workerSpinTime);
+    for (auto const &config : streamConfigs) {
+      RtspSession *session{nullptr};
+      if (REPLAY.empty()) {
+        std::unique_ptr<RtspSession> &entry{sessions[config.url]};
+        if (!entry) {
+          entry.reset(new RtspSession(config.url));
+        }
+        session = entry.get();
       }
+      std::unique_ptr<RtpStream> stream{new RtpStream(config, verbose,
+          recorder, workerPool, packetRecorder.get(), session)};
+      if (REPLAY.empty() && !stream->setup()) {
+        return retCode;
+      }
+      streams.push_back(std::move(stream));
+    }
+    for (auto &session : sessions) {
+      session.second->play();
     }
 
-    // RTSP teardown
-    curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, CURL_RTSPREQ_TEARDOWN);
-    curl_easy_perform(curl);
+    if (!REPLAY.empty()) {
+      std::map<uint32_t, RtpStream *> streamsBySenderStamp;
+      for (uint32_t i = 0; i < streams.size(); ++i) {
+        streamsBySenderStamp[streamConfigs[i].senderStamp] = streams[i].get();
+      }
 
-    curl_easy_cleanup(curl);
+      PacketReader packetReader(REPLAY);
+      if (!packetReader.isOpen()) {
+        return retCode;
+      }
 
-    if (decoder) {
-      decoder->Uninitialize();
-      WelsDestroyDecoder(decoder);
-    }
+      // Packets are fed in as fast as the streams take them, so the time
+      // taken is a measure of the receive and decode path.
+      uint64_t packetCount{0};
+      uint64_t byteCount{0};
+      auto const replayStart = std::chrono::steady_clock::now();
+      RecordedPacket packet;
+      while (od4->isRunning() && packetReader.read(packet)) {
+        auto stream = streamsBySenderStamp.find(packet.senderStamp);
+        if (stream == streamsBySenderStamp.end()) {
+          continue;
+        }
+        if (PacketKind::SDP == packet.kind) {
+          if (!stream->second->setupReplay(packet.data)) {
+            return retCode;
+          }
+        } else {
+          stream->second->replay(packet);
+          packetCount++;
+          byteCount += packet.data.size();
+        }
+      }
+      workerPool.drain();
+      double const replayTime{std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - replayStart).count()};
+      std::cout << "[opendlv-device-camera-rtp]: Replayed " << packetCount
+        << " packets (" << byteCount << " bytes) in " << replayTime << " s."
+        << std::endl;
+      workerPool.stop();
+    } else {
+      for (auto &stream : streams) {
+        stream->start();
+      }
+
+      if (handleTerminationSignals()) {
+        // Woken at once by SIGINT and SIGTERM; the timeout catches the OD4
+        // session ending for any other reason.
+        while (od4->isRunning()) {
+          struct pollfd termination;
+          termination.fd = g_terminationFd;
+          termination.events = POLLIN;
+          termination.revents = 0;
+          int32_t const result{::poll(&termination, 1, 1000)};
+          if (result < 0 && EINTR != errno) {
+            break;
+          }
+          uint64_t count;
+          if (result > 0 && ::read(g_terminationFd, &count, sizeof(count)) < 0
+              && EINTR != errno) {
+            break;
+          }
+        }
+      } else {
+        std::cerr << "[opendlv-device-camera-rtp]: Could not handle SIGINT "
+          << "and SIGTERM, polling for termination: " << strerror(errno)
+          << std::endl;
+        while (od4->isRunning()) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        }
+      }
 
-    if (verbose && nullptr != display) {
-      XCloseDisplay(display);
+      for (auto &stream : streams) {
+        stream->stop();
+      }
+      for (auto &session : sessions) {
+        session.second->teardown();
+      }
+      workerPool.stop();
     }
 
     retCode = 0;
   }
   return retCode;
 }
-
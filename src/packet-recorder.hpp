@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKET_RECORDER_HPP
+#define PACKET_RECORDER_HPP
+
+#include <endian.h>
+#include <sys/uio.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include "recording-file.hpp"
+
+enum class PacketKind : uint8_t {
+  RTP = 0,
+  RTCP = 1,
+  SDP = 2
+};
+
+struct RecordedPacket {
+  int64_t receivedInMicroseconds{0};
+  uint32_t senderStamp{0};
+  PacketKind kind{PacketKind::RTP};
+  std::string data{};
+};
+
+// Raw packet dumps (--rtp-dump) keep every received RTP and RTCP datagram, so
+// that a stream that failed to decode can be fed through the depacketizer
+// again (--replay-rtp). A dump starts with the eight bytes "RTPPKT" 0x00 0x01
+// (format version 1), followed by one record per packet, the 16-byte header
+// little-endian:
+//
+//   int64  kernel receive time stamp in microseconds since the epoch
+//   uint32 sender stamp of the stream
+//   uint16 number of payload bytes
+//   uint8  kind; 0 for RTP, 1 for RTCP, 2 for the stream's SDP
+//   uint8  reserved, 0
+//   payload
+//
+// The SDP record is written when the RTSP session is set up and carries the
+// session description that the replay needs for the SPS, PPS and clock rate.
+// The file is written through the AsyncBlockWriter of a direct I/O
+// RecordingFile, so the receive threads only copy the packet.
+class PacketRecorder {
+ private:
+  PacketRecorder(PacketRecorder const &) = delete;
+  PacketRecorder(PacketRecorder &&) = delete;
+  PacketRecorder &operator=(PacketRecorder const &) = delete;
+  PacketRecorder &operator=(PacketRecorder &&) = delete;
+
+ public:
+  explicit PacketRecorder(std::string const &name)
+    : m_mutex()
+    , m_file(name, 0, true)
+  {
+    m_file.write("RTPPKT\x00\x01", 8);
+    std::cout << "[opendlv-device-camera-rtp]: Created " << name << "."
+      << std::endl;
+  }
+
+  void write(PacketKind kind, uint32_t senderStamp,
+      std::chrono::system_clock::time_point const &received, char const *data,
+      size_t length)
+  {
+    if (length > 0xffff) {
+      return;
+    }
+    uint8_t header[16];
+    uint64_t const received_le = htole64(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+            received.time_since_epoch()).count()));
+    uint32_t const senderStamp_le = htole32(senderStamp);
+    uint16_t const size_le = htole16(static_cast<uint16_t>(length));
+    memcpy(header, &received_le, 8);
+    memcpy(header + 8, &senderStamp_le, 4);
+    memcpy(header + 12, &size_le, 2);
+    header[14] = static_cast<uint8_t>(kind);
+    header[15] = 0;
+
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<char *>(data);
+    iov[1].iov_len = length;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file.write(iov, 2);
+  }
+
+ private:
+  std::mutex m_mutex;
+  RecordingFile m_file;
+};
+
+// Reads back the records of a raw packet dump in order.
+class PacketReader {
+ private:
+  PacketReader(PacketReader const &) = delete;
+  PacketReader(PacketReader &&) = delete;
+  PacketReader &operator=(PacketReader const &) = delete;
+  PacketReader &operator=(PacketReader &&) = delete;
+
+ public:
+  explicit PacketReader(std::string const &name)
+    : m_file(name, std::ios::in | std::ios::binary)
+  {
+    char magic[8];
+    if (!m_file.read(magic, sizeof(magic))
+        || 0 != memcmp(magic, "RTPPKT\x00\x01", sizeof(magic))) {
+      std::cerr << "[opendlv-device-camera-rtp]: " << name
+        << " is not a raw packet dump." << std::endl;
+      m_file.close();
+    }
+  }
+
+  bool isOpen() const
+  {
+    return m_file.is_open();
+  }
+
+  bool read(RecordedPacket &packet)
+  {
+    uint8_t header[16];
+    if (!m_file.is_open()
+        || !m_file.read(reinterpret_cast<char *>(header), sizeof(header))) {
+      return false;
+    }
+    uint64_t received_le;
+    uint32_t senderStamp_le;
+    uint16_t size_le;
+    memcpy(&received_le, header, 8);
+    memcpy(&senderStamp_le, header + 8, 4);
+    memcpy(&size_le, header + 12, 2);
+    packet.receivedInMicroseconds = static_cast<int64_t>(le64toh(received_le));
+    packet.senderStamp = le32toh(senderStamp_le);
+    packet.kind = static_cast<PacketKind>(header[14]);
+    packet.data.resize(le16toh(size_le));
+    return static_cast<bool>(m_file.read(&packet.data[0],
+          static_cast<std::streamsize>(packet.data.size())));
+  }
+
+ private:
+  std::ifstream m_file;
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PRE_RECORD_BUFFER_HPP
+#define PRE_RECORD_BUFFER_HPP
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cluon-complete.hpp"
+
+// A compressed access unit on its way to the recording. The frame data is
+// shared with the decoder job, so keeping it around costs no copy.
+struct RecordedFrame {
+  std::shared_ptr<std::string const> data{nullptr};
+  std::string fourcc{};
+  uint32_t width{0};
+  uint32_t height{0};
+  uint32_t senderStamp{0};
+  cluon::data::TimeStamp sampleTimeStamp{};
+  uint32_t rtpTimestamp{0};
+  bool isKeyframe{false};
+};
+
+// Holds the most recent frames of one stream while no recording is open, so
+// that the seconds before a remote RecorderCommand can still be recorded.
+// Frames are kept as whole GOPs: the buffer always starts at a keyframe and
+// the oldest GOP is dropped once the next one alone covers the wanted
+// duration, or when the byte limit is exceeded.
+class PreRecordBuffer {
+ public:
+  PreRecordBuffer(int64_t durationInMicroseconds, uint64_t maxBytes)
+    : m_durationInMicroseconds(durationInMicroseconds)
+    , m_maxBytes(maxBytes)
+    , m_gops()
+    , m_bytes(0)
+  {
+  }
+
+  void push(RecordedFrame const &frame)
+  {
+    if (frame.isKeyframe) {
+      m_gops.emplace_back();
+    } else if (m_gops.empty()) {
+      // Nothing decodable to attach the frame to.
+      return;
+    }
+    m_gops.back().push_back(frame);
+    m_bytes += frame.data->size();
+
+    int64_t const oldest{
+      cluon::time::toMicroseconds(frame.sampleTimeStamp)
+        - m_durationInMicroseconds};
+    while (m_gops.size() > 1) {
+      bool const isCovered{cluon::time::toMicroseconds(
+          m_gops[1].front().sampleTimeStamp) <= oldest};
+      if (!isCovered && m_bytes <= m_maxBytes) {
+        break;
+      }
+      dropOldestGop();
+    }
+    if (m_bytes > m_maxBytes) {
+      // A single GOP larger than the limit; wait for the next keyframe.
+      dropOldestGop();
+    }
+  }
+
+  // Hands out all buffered frames in order and empties the buffer.
+  std::vector<RecordedFrame> take()
+  {
+    std::vector<RecordedFrame> frames;
+    for (auto &gop : m_gops) {
+      frames.insert(frames.end(), gop.begin(), gop.end());
+    }
+    m_gops.clear();
+    m_bytes = 0;
+    return frames;
+  }
+
+ private:
+  void dropOldestGop()
+  {
+    for (auto const &frame : m_gops.front()) {
+      m_bytes -= frame.data->size();
+    }
+    m_gops.pop_front();
+  }
+
+  int64_t const m_durationInMicroseconds;
+  uint64_t const m_maxBytes;
+  std::deque<std::vector<RecordedFrame>> m_gops;
+  uint64_t m_bytes;
+};
+
+#endif
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RECORDER_HPP
+#define RECORDER_HPP
+
+#include <endian.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cluon-complete.hpp"
+#include "envelope-encoder.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "pre-record-buffer.hpp"
+#include "recording-file.hpp"
+
+struct RecorderConfig {
+  int64_t preRecordDurationInMicroseconds;
+  uint64_t preRecordMaxBytes;
+  uint64_t maxBytes;
+  int64_t maxDurationInMicroseconds;
+  bool isDirectIo;
+};
+
+// The .rec file shared by all streams and the remote RecorderCommand handler.
+//
+// Next to each recording, a seek index <name>.idx is written so that replay
+// tools can binary search for the keyframe closest to a point in time instead
+// of scanning the whole .rec file. It starts with the eight bytes "RTPIDX" 0x00
+// 0x01 (format version 1), followed by one 32-byte entry per recorded frame,
+// all fields little-endian and in the order the frames were written:
+//
+//   uint64 byte offset of the frame's envelope in the .rec file
+//   int64  sample time stamp in microseconds since the epoch
+//   uint32 RTP timestamp of the frame
+//   uint32 frame number, counted per sender stamp from 0
+//   uint32 sender stamp
+//   uint32 flags; bit 0 is set for keyframes (IDR, or SPS in front of one)
+//
+// With a pre-record duration, frames arriving while no file is open are kept
+// in a PreRecordBuffer per sender stamp and written first into the next file.
+//
+// With a size or duration limit, the recording is split into segments named
+// <name>, <name>_001, ... (before a .rec extension). A full segment is left at
+// the next keyframe, so the limits may be exceeded by up to one GOP. Every
+// sender switches to the new segment at its own next keyframe; until then its
+// frames still go to the previous segment, so each segment starts decodable
+// for every camera.
+//
+// With direct I/O, the .rec files are written with O_DIRECT from aligned
+// buffers in the background (see RecordingFile); the small index files are
+// always written through the page cache.
+class Recorder {
+ private:
+  Recorder(Recorder const &) = delete;
+  Recorder(Recorder &&) = delete;
+  Recorder &operator=(Recorder const &) = delete;
+  Recorder &operator=(Recorder &&) = delete;
+
+ public:
+  explicit Recorder(RecorderConfig const &config)
+    : m_config(config)
+    , m_mutex()
+    , m_name()
+    , m_segmentCount(0)
+    , m_current(nullptr)
+    , m_previous(nullptr)
+    , m_pendingSenders()
+    , m_preRecordBuffers()
+  {
+  }
+
+  ~Recorder()
+  {
+    close();
+  }
+
+  void open(std::string const &name)
+  {
+    std::lock_guard<std::mutex> lck(m_mutex);
+    closeSegments();
+    m_name = name;
+    m_segmentCount = 0;
+    m_current = openSegment();
+
+    std::vector<RecordedFrame> frames;
+    for (auto &preRecordBuffer : m_preRecordBuffers) {
+      std::vector<RecordedFrame> bufferedFrames{preRecordBuffer.second.take()};
+      frames.insert(frames.end(), bufferedFrames.begin(), bufferedFrames.end());
+    }
+    std::stable_sort(frames.begin(), frames.end(),
+        [](RecordedFrame const &a, RecordedFrame const &b) {
+          return cluon::time::toMicroseconds(a.sampleTimeStamp)
+            < cluon::time::toMicroseconds(b.sampleTimeStamp);
+        });
+    for (auto const &frame : frames) {
+      writeRecordedFrame(frame);
+    }
+    if (!frames.empty()) {
+      std::cout << "[opendlv-device-camera-rtp]: Wrote " << frames.size()
+        << " pre-recorded frames to " << m_name << "." << std::endl;
+    }
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lck(m_mutex);
+    closeSegments();
+  }
+
+  void write(cluon::data::Envelope &&envelope)
+  {
+    std::lock_guard<std::mutex> lck(m_mutex);
+    if (m_current) {
+      writeEnvelope(*m_current, std::move(envelope));
+    }
+  }
+
+  // Writes a video frame and adds it to the seek index, or keeps it for
+  // pre-recording while no file is open.
+  void writeFrame(RecordedFrame const &frame)
+  {
+    std::lock_guard<std::mutex> lck(m_mutex);
+    if (m_current) {
+      writeRecordedFrame(frame);
+    } else if (m_config.preRecordDurationInMicroseconds > 0) {
+      auto entry = m_preRecordBuffers.find(frame.senderStamp);
+      if (entry == m_preRecordBuffers.end()) {
+        entry = m_preRecordBuffers.emplace(frame.senderStamp,
+            PreRecordBuffer(m_config.preRecordDurationInMicroseconds,
+              m_config.preRecordMaxBytes)).first;
+      }
+      entry->second.push(frame);
+    }
+  }
+
+ private:
+  struct Segment {
+    std::string name{};
+    std::unique_ptr<RecordingFile> file{nullptr};
+    std::unique_ptr<RecordingFile> index{nullptr};
+    std::map<uint32_t, uint32_t> frameNumbers{};
+    int64_t startInMicroseconds{0};
+  };
+
+  std::string segmentName(uint32_t segment) const
+  {
+    if (0 == segment) {
+      return m_name;
+    }
+    std::stringstream sstr;
+    sstr << "_" << std::setw(3) << std::setfill('0') << segment;
+    std::string const extension{".rec"};
+    if (m_name.size() > extension.size() && 0 == m_name.compare(
+          m_name.size() - extension.size(), extension.size(), extension)) {
+      return m_name.substr(0, m_name.size() - extension.size()) + sstr.str()
+        + extension;
+    }
+    return m_name + sstr.str();
+  }
+
+  std::unique_ptr<Segment> openSegment()
+  {
+    std::unique_ptr<Segment> segment{new Segment};
+    segment->name = segmentName(m_segmentCount++);
+    segment->file.reset(new RecordingFile(segment->name, m_config.maxBytes,
+          m_config.isDirectIo));
+    segment->index.reset(new RecordingFile(segment->name + ".idx", 0, false));
+    segment->index->write("RTPIDX\x00\x01", 8);
+    std::cout << "[opendlv-device-camera-rtp]: Created " << segment->name
+      << "." << std::endl;
+    return segment;
+  }
+
+  void closeSegment(std::unique_ptr<Segment> &segment)
+  {
+    if (segment) {
+      segment->index->close();
+      if (segment->file->isOpen()) {
+        segment->file->close();
+        std::cout << "[opendlv-device-camera-rtp]: Closed " << segment->name
+          << "." << std::endl;
+      }
+      segment = nullptr;
+    }
+  }
+
+  void closeSegments()
+  {
+    closeSegment(m_previous);
+    closeSegment(m_current);
+    m_pendingSenders.clear();
+  }
+
+  bool isFull(Segment const &segment, RecordedFrame const &frame) const
+  {
+    bool const isSizeReached{(m_config.maxBytes > 0)
+      && (segment.file->size() >= m_config.maxBytes)};
+    bool const isDurationReached{(m_config.maxDurationInMicroseconds > 0)
+      && (0 != segment.startInMicroseconds)
+      && (cluon::time::toMicroseconds(frame.sampleTimeStamp)
+          - segment.startInMicroseconds
+          >= m_config.maxDurationInMicroseconds)};
+    return isSizeReached || isDurationReached;
+  }
+
+  void rotate(uint32_t senderStamp)
+  {
+    closeSegment(m_previous);
+    m_pendingSenders.clear();
+    for (auto const &frameNumber : m_current->frameNumbers) {
+      if (frameNumber.first != senderStamp) {
+        m_pendingSenders.insert(frameNumber.first);
+      }
+    }
+    m_previous = std::move(m_current);
+    m_current = openSegment();
+    if (m_pendingSenders.empty()) {
+      closeSegment(m_previous);
+    }
+  }
+
+  void writeRecordedFrame(RecordedFrame const &frame)
+  {
+    if (m_previous && m_pendingSenders.count(frame.senderStamp)) {
+      if (!frame.isKeyframe) {
+        writeRecordedFrame(*m_previous, frame);
+        return;
+      }
+      m_pendingSenders.erase(frame.senderStamp);
+      if (m_pendingSenders.empty()) {
+        closeSegment(m_previous);
+      }
+    } else if (frame.isKeyframe && isFull(*m_current, frame)) {
+      rotate(frame.senderStamp);
+    }
+    writeRecordedFrame(*m_current, frame);
+  }
+
+  void writeRecordedFrame(Segment &segment, RecordedFrame const &frame)
+  {
+    if (0 == segment.startInMicroseconds) {
+      segment.startInMicroseconds =
+        cluon::time::toMicroseconds(frame.sampleTimeStamp);
+    }
+
+    uint64_t const offset{segment.file->size()};
+
+    std::string head;
+    std::string tail;
+    if (encodeImageReadingEnvelope(frame.fourcc, frame.width, frame.height,
+          frame.data->size(), cluon::time::now(), frame.sampleTimeStamp,
+          frame.senderStamp, head, tail)) {
+      struct iovec iov[3];
+      iov[0].iov_base = const_cast<char *>(head.data());
+      iov[0].iov_len = head.size();
+      iov[1].iov_base = const_cast<char *>(frame.data->data());
+      iov[1].iov_len = frame.data->size();
+      iov[2].iov_base = const_cast<char *>(tail.data());
+      iov[2].iov_len = tail.size();
+      segment.file->write(iov, 3);
+    } else {
+      opendlv::proxy::ImageReading ir;
+      ir.fourcc(frame.fourcc).width(frame.width).height(frame.height)
+        .data(*frame.data);
+
+      cluon::data::Envelope envelope;
+      {
+        cluon::ToProtoVisitor protoEncoder;
+        {
+          envelope.dataType(ir.ID());
+          ir.accept(protoEncoder);
+          envelope.serializedData(protoEncoder.encodedData());
+          envelope.sent(cluon::time::now());
+          envelope.sampleTimeStamp(frame.sampleTimeStamp);
+          envelope.senderStamp(frame.senderStamp);
+        }
+      }
+      writeEnvelope(segment, std::move(envelope));
+    }
+
+    {
+      uint8_t entry[32];
+      uint64_t const offset_le = htole64(offset);
+      uint64_t const sampleTimeStamp_le = htole64(static_cast<uint64_t>(
+            cluon::time::toMicroseconds(frame.sampleTimeStamp)));
+      uint32_t const rtpTimestamp_le = htole32(frame.rtpTimestamp);
+      uint32_t const frameNumber_le =
+        htole32(segment.frameNumbers[frame.senderStamp]++);
+      uint32_t const senderStamp_le = htole32(frame.senderStamp);
+      uint32_t const flags_le = htole32(frame.isKeyframe ? 0x1 : 0x0);
+      memcpy(entry, &offset_le, 8);
+      memcpy(entry + 8, &sampleTimeStamp_le, 8);
+      memcpy(entry + 16, &rtpTimestamp_le, 4);
+      memcpy(entry + 20, &frameNumber_le, 4);
+      memcpy(entry + 24, &senderStamp_le, 4);
+      memcpy(entry + 28, &flags_le, 4);
+      segment.index->write(reinterpret_cast<char const *>(entry),
+          sizeof(entry));
+    }
+  }
+
+  void writeEnvelope(Segment &segment, cluon::data::Envelope &&envelope)
+  {
+    std::string serializedData{cluon::serializeEnvelope(std::move(envelope))};
+    segment.file->write(serializedData.data(), serializedData.size());
+  }
+
+  RecorderConfig const m_config;
+  std::mutex m_mutex;
+  std::string m_name;
+  uint32_t m_segmentCount;
+  std::unique_ptr<Segment> m_current;
+  std::unique_ptr<Segment> m_previous;
+  std::set<uint32_t> m_pendingSenders;
+  std::map<uint32_t, PreRecordBuffer> m_preRecordBuffers;
+};
+
+#endif
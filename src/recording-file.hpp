@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RECORDING_FILE_HPP
+#define RECORDING_FILE_HPP
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "async-block-writer.hpp"
+
+// An append-only file written with plain system calls. Space can be reserved
+// up front with fallocate, which keeps the file contiguous on FAT/exFAT and
+// other allocators that fragment under many small appends; the unused part of
+// the reservation is released again when the file is closed.
+//
+// With direct I/O, the data is collected in aligned blocks that are written
+// with O_DIRECT by an AsyncBlockWriter, so that recording neither fills the
+// page cache nor blocks the caller on the disk. File systems without O_DIRECT
+// support (such as tmpfs) get the same blocks through the page cache. The
+// last block is padded to the alignment and cut off again when closing.
+class RecordingFile {
+ private:
+  RecordingFile(RecordingFile const &) = delete;
+  RecordingFile(RecordingFile &&) = delete;
+  RecordingFile &operator=(RecordingFile const &) = delete;
+  RecordingFile &operator=(RecordingFile &&) = delete;
+
+ public:
+  RecordingFile(std::string const &name, uint64_t preallocateBytes,
+      bool isDirectIo)
+    : m_name(name)
+    , m_fd(-1)
+    , m_size(0)
+    , m_isPreallocated(false)
+    , m_blocks()
+    , m_block(0)
+    , m_blockFill(0)
+    , m_blockOffset(0)
+    , m_writer(nullptr)
+  {
+    int32_t const flags{O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC};
+    if (isDirectIo) {
+      m_fd = ::open(m_name.c_str(), flags | O_DIRECT, 0644);
+      if (-1 == m_fd && EINVAL == errno) {
+        std::cerr << "[opendlv-device-camera-rtp]: No direct I/O for "
+          << m_name << ", using the page cache." << std::endl;
+      }
+    }
+    if (-1 == m_fd) {
+      m_fd = ::open(m_name.c_str(), flags, 0644);
+    }
+    if (-1 == m_fd) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not open " << m_name
+        << ": " << strerror(errno) << std::endl;
+      return;
+    }
+    if (preallocateBytes > 0) {
+      if (0 == ::fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0,
+            static_cast<off_t>(preallocateBytes))) {
+        m_isPreallocated = true;
+      } else {
+        std::cerr << "[opendlv-device-camera-rtp]: Could not preallocate "
+          << preallocateBytes << " bytes for " << m_name << ": "
+          << strerror(errno) << std::endl;
+      }
+    }
+    if (isDirectIo) {
+      for (uint32_t i = 0; i < BLOCK_COUNT; ++i) {
+        void *block{nullptr};
+        if (0 != ::posix_memalign(&block, ALIGNMENT, BLOCK_BYTES)) {
+          std::cerr << "[opendlv-device-camera-rtp]: Could not allocate "
+            << "direct I/O buffers for " << m_name << "." << std::endl;
+          close();
+          return;
+        }
+        m_blocks.emplace_back(static_cast<char *>(block), &::free);
+      }
+      m_writer.reset(new AsyncBlockWriter(m_fd, BLOCK_COUNT));
+    }
+  }
+
+  ~RecordingFile()
+  {
+    close();
+  }
+
+  bool isOpen() const
+  {
+    return -1 != m_fd;
+  }
+
+  uint64_t size() const
+  {
+    return m_size;
+  }
+
+  bool write(char const *data, size_t len)
+  {
+    if (m_writer) {
+      return append(data, len);
+    }
+    while (isOpen() && len > 0) {
+      ssize_t const n = ::write(m_fd, data, len);
+      if (n < 0) {
+        if (EINTR == errno) {
+          continue;
+        }
+        std::cerr << "[opendlv-device-camera-rtp]: Writing to " << m_name
+          << " failed: " << strerror(errno) << std::endl;
+        close();
+        return false;
+      }
+      data += n;
+      len -= static_cast<size_t>(n);
+      m_size += static_cast<uint64_t>(n);
+    }
+    return isOpen();
+  }
+
+  // Writes the buffers in order with as few system calls as possible.
+  bool write(struct iovec *iov, int32_t count)
+  {
+    if (m_writer) {
+      for (int32_t i = 0; i < count; ++i) {
+        append(static_cast<char const *>(iov[i].iov_base), iov[i].iov_len);
+      }
+      return isOpen();
+    }
+    while (isOpen() && count > 0) {
+      ssize_t n = ::writev(m_fd, iov, count);
+      if (n < 0) {
+        if (EINTR == errno) {
+          continue;
+        }
+        std::cerr << "[opendlv-device-camera-rtp]: Writing to " << m_name
+          << " failed: " << strerror(errno) << std::endl;
+        close();
+        return false;
+      }
+      m_size += static_cast<uint64_t>(n);
+      // Skip what has been written after a partial write.
+      while (count > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+        n -= static_cast<ssize_t>(iov->iov_len);
+        iov++;
+        count--;
+      }
+      if (count > 0) {
+        iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+        iov->iov_len -= static_cast<size_t>(n);
+      }
+    }
+    return isOpen();
+  }
+
+  void close()
+  {
+    if (isOpen()) {
+      bool const isPadded{m_writer && 0 != m_blockFill % ALIGNMENT};
+      if (m_writer) {
+        if (m_blockFill > 0) {
+          size_t const len{(m_blockFill + ALIGNMENT - 1) / ALIGNMENT
+            * ALIGNMENT};
+          memset(m_blocks[m_block].get() + m_blockFill, 0, len - m_blockFill);
+          m_writer->submit(m_block, m_blocks[m_block].get(), len,
+              m_blockOffset);
+          m_blockFill = 0;
+        }
+        // Waits for all outstanding writes.
+        m_writer.reset();
+      }
+      if (m_isPreallocated || isPadded) {
+        // Give back the reserved blocks or padding behind the written data.
+        if (0 != ::ftruncate(m_fd, static_cast<off_t>(m_size))) {
+          std::cerr << "[opendlv-device-camera-rtp]: Could not trim "
+            << m_name << ": " << strerror(errno) << std::endl;
+        }
+      }
+      ::close(m_fd);
+      m_fd = -1;
+    }
+  }
+
+ private:
+  static constexpr size_t ALIGNMENT{4096};
+  static constexpr size_t BLOCK_BYTES{4 * 1024 * 1024};
+  static constexpr uint32_t BLOCK_COUNT{2};
+
+  // Copies into the current block and hands full blocks to the writer.
+  bool append(char const *data, size_t len)
+  {
+    while (isOpen() && len > 0) {
+      size_t const n{std::min(len, BLOCK_BYTES - m_blockFill)};
+      memcpy(m_blocks[m_block].get() + m_blockFill, data, n);
+      data += n;
+      len -= n;
+      m_blockFill += n;
+      m_size += n;
+      if (BLOCK_BYTES == m_blockFill) {
+        m_writer->submit(m_block, m_blocks[m_block].get(), BLOCK_BYTES,
+            m_blockOffset);
+        m_blockOffset += BLOCK_BYTES;
+        m_blockFill = 0;
+        m_block = (m_block + 1) % BLOCK_COUNT;
+        if (!m_writer->wait(m_block)) {
+          std::cerr << "[opendlv-device-camera-rtp]: Writing to " << m_name
+            << " failed." << std::endl;
+          close();
+          return false;
+        }
+      }
+    }
+    return isOpen();
+  }
+
+  std::string const m_name;
+  int32_t m_fd;
+  uint64_t m_size;
+  bool m_isPreallocated;
+  std::vector<std::unique_ptr<char, void (*)(void *)>> m_blocks;
+  uint32_t m_block;
+  size_t m_blockFill;
+  uint64_t m_blockOffset;
+  std::unique_ptr<AsyncBlockWriter> m_writer;
+};
+
+#endif
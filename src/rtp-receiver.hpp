@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTP_RECEIVER_HPP
+#define RTP_RECEIVER_HPP
+
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Receives the RTP or RTCP datagrams of one port. Unlike cluon::UDPReceiver,
+// which asks for the receive time with an extra SIOCGSTAMP ioctl after every
+// recvfrom, the kernel hands the time stamp over as a control message
+// (SO_TIMESTAMPNS, in nanoseconds) together with each datagram, so up to
+// BATCH_SIZE datagrams are read with a single recvmmsg. With hardware time
+// stamping, SO_TIMESTAMPING is asked for the time stamp of the network card
+// instead; it is used when the card provides one (which needs time stamping
+// enabled on the interface, e.g. with hwstamp_ctl) and is only meaningful if
+// the card's clock is synchronised to the system clock, e.g. by phc2sys.
+//
+// The receive buffer is set with SO_RCVBUFFORCE where permitted (CAP_NET_ADMIN)
+// so that it is not clamped to net.core.rmem_max, and the size the kernel
+// actually granted is reported. SO_RXQ_OVFL makes the kernel attach its count
+// of datagrams dropped on this socket for lack of buffer space to every
+// datagram; new drops are reported at most once per second. With busy
+// polling (SO_BUSY_POLL, which needs CAP_NET_ADMIN above net.core.busy_read),
+// the kernel polls the network card's queue instead of waiting for its
+// interrupt.
+//
+// The receiver has no thread of its own; receive() is meant to be called from
+// an EventLoop whenever the socket is readable, and calls the delegate for
+// every datagram waiting.
+class RtpReceiver {
+ private:
+  RtpReceiver(RtpReceiver const &) = delete;
+  RtpReceiver(RtpReceiver &&) = delete;
+  RtpReceiver &operator=(RtpReceiver const &) = delete;
+  RtpReceiver &operator=(RtpReceiver &&) = delete;
+
+ public:
+  using Delegate = std::function<void(char const *, size_t,
+      std::chrono::system_clock::time_point const &)>;
+
+  RtpReceiver(std::string const &address, uint16_t port,
+      int32_t receiveBufferSize, bool isHardwareTimestamping,
+      int32_t busyPollMicroseconds, Delegate &&delegate)
+    : m_delegate(std::move(delegate))
+    , m_port(port)
+    , m_socket(-1)
+    , m_buffers(BATCH_SIZE * MAX_PACKET_SIZE)
+    , m_droppedPackets(0)
+    , m_reportedDroppedPackets(0)
+    , m_lastDropReport()
+  {
+    m_socket = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+        IPPROTO_UDP);
+    if (-1 == m_socket) {
+      fail("create socket");
+      return;
+    }
+
+    int32_t const yes{1};
+    ::setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    if (0 != ::setsockopt(m_socket, SOL_SOCKET, SO_RCVBUFFORCE,
+          &receiveBufferSize, sizeof(receiveBufferSize))
+        && 0 != ::setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF,
+          &receiveBufferSize, sizeof(receiveBufferSize))) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not set SO_RCVBUF to "
+        << receiveBufferSize << ": " << strerror(errno) << std::endl;
+    }
+    {
+      // The kernel doubles the value for its bookkeeping overhead.
+      int32_t effectiveSize{0};
+      socklen_t len{sizeof(effectiveSize)};
+      ::getsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, &effectiveSize, &len);
+      std::clog << "[opendlv-device-camera-rtp]: Receive buffer of port "
+        << port << " is " << effectiveSize / 2 << " bytes (requested "
+        << receiveBufferSize << ")." << std::endl;
+      if (effectiveSize / 2 < receiveBufferSize) {
+        std::cerr << "[opendlv-device-camera-rtp]: Receive buffer of port "
+          << port << " is limited by net.core.rmem_max; raise it or grant "
+          << "CAP_NET_ADMIN." << std::endl;
+      }
+    }
+    if (busyPollMicroseconds > 0 && 0 != ::setsockopt(m_socket, SOL_SOCKET,
+          SO_BUSY_POLL, &busyPollMicroseconds, sizeof(busyPollMicroseconds))) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not enable busy "
+        << "polling on port " << port << ": " << strerror(errno) << std::endl;
+    }
+    if (0 != ::setsockopt(m_socket, SOL_SOCKET, SO_RXQ_OVFL, &yes,
+          sizeof(yes))) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not enable drop "
+        << "counting on port " << port << ": " << strerror(errno)
+        << std::endl;
+    }
+
+    if (isHardwareTimestamping) {
+      int32_t const flags{SOF_TIMESTAMPING_RX_HARDWARE
+        | SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_SOFTWARE
+        | SOF_TIMESTAMPING_SOFTWARE};
+      if (0 != ::setsockopt(m_socket, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+            sizeof(flags))) {
+        std::cerr << "[opendlv-device-camera-rtp]: Could not enable hardware "
+          << "time stamps on port " << port << ": " << strerror(errno)
+          << std::endl;
+        isHardwareTimestamping = false;
+      }
+    }
+    if (!isHardwareTimestamping) {
+      ::setsockopt(m_socket, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof(yes));
+    }
+
+    struct sockaddr_in local;
+    std::memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = ::inet_addr(address.c_str());
+    local.sin_port = htons(port);
+    if (0 != ::bind(m_socket, reinterpret_cast<struct sockaddr *>(&local),
+          sizeof(local))) {
+      fail("bind to " + address + ":" + std::to_string(port));
+      return;
+    }
+  }
+
+  ~RtpReceiver()
+  {
+    if (-1 != m_socket) {
+      ::close(m_socket);
+    }
+  }
+
+  int32_t fd() const
+  {
+    return m_socket;
+  }
+
+  // Number of datagrams the kernel had to drop since the socket was opened.
+  uint32_t droppedPackets() const
+  {
+    return m_droppedPackets;
+  }
+
+  // Reads and hands over all datagrams waiting in the socket.
+  void receive()
+  {
+    struct mmsghdr msgs[BATCH_SIZE];
+    struct iovec iovs[BATCH_SIZE];
+    char controls[BATCH_SIZE][CMSG_SPACE(sizeof(struct scm_timestamping))
+      + CMSG_SPACE(sizeof(uint32_t))];
+
+    int32_t received{0};
+    do {
+      for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+        iovs[i].iov_base = &m_buffers[i * MAX_PACKET_SIZE];
+        iovs[i].iov_len = MAX_PACKET_SIZE;
+        std::memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = controls[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+      }
+      received = ::recvmmsg(m_socket, msgs, BATCH_SIZE, 0, nullptr);
+      for (int32_t i = 0; i < received; ++i) {
+        if (0 == msgs[i].msg_len) {
+          continue;
+        }
+        m_delegate(&m_buffers[i * MAX_PACKET_SIZE], msgs[i].msg_len,
+            parseControlMessages(&msgs[i].msg_hdr));
+      }
+      reportDrops();
+    } while (received == static_cast<int32_t>(BATCH_SIZE));
+  }
+
+ private:
+  static constexpr uint32_t BATCH_SIZE{16};
+  static constexpr size_t MAX_PACKET_SIZE{65536};
+
+  void fail(std::string const &what)
+  {
+    std::cerr << "[opendlv-device-camera-rtp]: Could not " << what << ": "
+      << strerror(errno) << std::endl;
+    if (-1 != m_socket) {
+      ::close(m_socket);
+      m_socket = -1;
+    }
+  }
+
+  // Returns the receive time stamp and picks up the drop count.
+  std::chrono::system_clock::time_point parseControlMessages(
+      struct msghdr *msg)
+  {
+    bool hasTimestamp{false};
+    struct timespec ts;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); nullptr != cmsg;
+        cmsg = CMSG_NXTHDR(msg, cmsg)) {
+      if (SOL_SOCKET != cmsg->cmsg_level) {
+        continue;
+      }
+      if (SCM_TIMESTAMPNS == cmsg->cmsg_type) {
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        hasTimestamp = true;
+      } else if (SCM_TIMESTAMPING == cmsg->cmsg_type) {
+        struct scm_timestamping timestamps;
+        memcpy(&timestamps, CMSG_DATA(cmsg), sizeof(timestamps));
+        // Index 2 holds the raw hardware time stamp, index 0 the software one.
+        ts = (0 != timestamps.ts[2].tv_sec) ? timestamps.ts[2]
+          : timestamps.ts[0];
+        hasTimestamp = true;
+      } else if (SO_RXQ_OVFL == cmsg->cmsg_type) {
+        memcpy(&m_droppedPackets, CMSG_DATA(cmsg), sizeof(m_droppedPackets));
+      }
+    }
+    if (!hasTimestamp) {
+      return std::chrono::system_clock::now();
+    }
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::seconds(ts.tv_sec)
+          + std::chrono::nanoseconds(ts.tv_nsec)));
+  }
+
+  void reportDrops()
+  {
+    if (m_droppedPackets == m_reportedDroppedPackets) {
+      return;
+    }
+    auto const now = std::chrono::steady_clock::now();
+    if (now - m_lastDropReport < std::chrono::seconds(1)) {
+      return;
+    }
+    std::cerr << "[opendlv-device-camera-rtp]: Receive buffer of port "
+      << m_port << " overran, " << (m_droppedPackets - m_reportedDroppedPackets)
+      << " packets dropped (" << m_droppedPackets << " in total)."
+      << std::endl;
+    m_reportedDroppedPackets = m_droppedPackets;
+    m_lastDropReport = now;
+  }
+
+  Delegate m_delegate;
+  uint16_t const m_port;
+  int32_t m_socket;
+  std::vector<char> m_buffers;
+  uint32_t m_droppedPackets;
+  uint32_t m_reportedDroppedPackets;
+  std::chrono::steady_clock::time_point m_lastDropReport;
+};
+
+#endif
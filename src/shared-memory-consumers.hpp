@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHARED_MEMORY_CONSUMERS_HPP
+#define SHARED_MEMORY_CONSUMERS_HPP
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "cluon-complete.hpp"
+
+// Returns how many other processes are attached to the given shared memory,
+// or -1 if that can not be told. cluon keys its SysV segments on the token
+// file carrying the segment's name, so the attach count can be read back from
+// the kernel; the POSIX implementation does not keep such a count.
+inline int32_t countSharedMemoryConsumers(cluon::SharedMemory &sharedMemory)
+{
+  char const *CLUON_SHAREDMEMORY_POSIX = getenv("CLUON_SHAREDMEMORY_POSIX");
+  if ((nullptr != CLUON_SHAREDMEMORY_POSIX)
+      && (CLUON_SHAREDMEMORY_POSIX[0] == '1')) {
+    return -1;
+  }
+
+  key_t const key = ftok(sharedMemory.name().c_str(), 1);
+  if (-1 == key) {
+    return -1;
+  }
+  int32_t const id = shmget(key, 0, 0);
+  if (-1 == id) {
+    return -1;
+  }
+  struct shmid_ds info;
+  if (-1 == shmctl(id, IPC_STAT, &info)) {
+    return -1;
+  }
+  // Do not count the attachment of this process.
+  return static_cast<int32_t>(info.shm_nattch) - 1;
+}
+
+#endif
@@ -26,11 +26,29 @@ struct SpsInfo {
 
 namespace {
 
+// Reads bitCount bits of the len bytes in buf. Bits past the end read as
+// zero, but still advance bitOffset, so that callers can tell a truncated
+// parameter set by bitOffset > len * 8.
+inline uint32_t extract(uint8_t const *buf, uint32_t const len,
+    uint32_t const bitCount, uint32_t &bitOffset)
+{
+  uint32_t ret = 0;
+  for (uint32_t i = 0; i < bitCount; ++i) {
+    ret <<= 1;
+    if (bitOffset < len * 8
+        && (buf[bitOffset / 8] & (0x80 >> (bitOffset % 8)))) {
+      ret += 1;
+    }
+    bitOffset++;
+  }
+  return ret;
+}
+
 inline uint32_t extractUnsignedExpGolomb(uint8_t const *buf,
-    uint32_t const wordLen, uint32_t &bitOffset)
+    uint32_t const len, uint32_t &bitOffset)
 {
   uint32_t zeroCount = 0;
-  while (bitOffset < wordLen * 8) {
+  while (bitOffset < len * 8) {
     if (buf[bitOffset / 8] & (0x80 >> (bitOffset % 8))) {
       break;
     }
@@ -39,22 +57,20 @@ inline uint32_t extractUnsignedExpGolomb(uint8_t const *buf,
   }
   bitOffset++;
 
-  uint32_t ret = 0;
-  for (uint32_t i = 0; i < zeroCount; i++) {
-    ret <<= 1;
-    if (buf[bitOffset / 8] & (0x80 >> (bitOffset % 8))) {
-      ret += 1;
-    }
-    bitOffset++;
+  // No valid code is longer than 32 bits.
+  if (zeroCount > 31) {
+    bitOffset = len * 8 + 1;
+    return 0;
   }
-  return (1 << zeroCount) - 1 + ret;
+  uint32_t const ret = extract(buf, len, zeroCount, bitOffset);
+  return (1u << zeroCount) - 1 + ret;
 }
 
 
 inline int32_t extractSignedExpGolomb(uint8_t const *buf,
-    uint32_t const wordLen, uint32_t &bitOffset)
+    uint32_t const len, uint32_t &bitOffset)
 {
-  int32_t v = extractUnsignedExpGolomb(buf, wordLen, bitOffset);
+  int32_t v = extractUnsignedExpGolomb(buf, len, bitOffset);
   int32_t ret = static_cast<int32_t>(ceil(static_cast<double>(v) / 2.0));
   if (v % 2 == 0) {
     ret = -ret;
@@ -62,67 +78,96 @@ inline int32_t extractSignedExpGolomb(uint8_t const *buf,
   return ret;
 }
 
-
-inline uint32_t extract(uint8_t const *buf, uint32_t const wordLen,
-    uint32_t &bitOffset)
+// Drops the emulation prevention bytes (0x03 after two zero bytes) that keep
+// start codes out of a NAL unit's payload.
+inline std::string removeEmulationPrevention(uint8_t const *buf,
+    uint32_t const len)
 {
-  uint32_t ret = 0;
-  for (uint32_t i = 0; i < wordLen; ++i) {
-    ret <<= 1;
-    if (buf[bitOffset / 8] & (0x80 >> (bitOffset % 8))) {
-      ret += 1;
+  std::string rbsp;
+  rbsp.reserve(len);
+  uint32_t zeroCount = 0;
+  for (uint32_t i = 0; i < len; ++i) {
+    if (zeroCount >= 2 && buf[i] == 0x03) {
+      zeroCount = 0;
+      continue;
     }
-    bitOffset++;
+    zeroCount = (buf[i] == 0x00) ? zeroCount + 1 : 0;
+    rbsp.push_back(static_cast<char>(buf[i]));
   }
-  return ret;
+  return rbsp;
 }
 
 }
 
-inline SpsInfo decodeSps(uint8_t const *buf, uint32_t const len)
+// The H.264 sequence parameter set (ITU-T H.264, 7.3.2.1.1); the size is that
+// of the pictures after frame cropping, which is what the decoder outputs.
+inline SpsInfo decodeSps(uint8_t const *nal, uint32_t const nalLen)
 {
-  SpsInfo spsInfo;
+  SpsInfo spsInfo{0, 0, 0};
+
+  std::string const rbsp{removeEmulationPrevention(nal, nalLen)};
+  uint8_t const *buf = reinterpret_cast<uint8_t const *>(rbsp.data());
+  uint32_t const len = static_cast<uint32_t>(rbsp.size());
+  if (len < 4) {
+    return spsInfo;
+  }
   
   uint32_t bitOffset = 0;
 
-  uint32_t forbiddenZeroBit = extract(buf, 1, bitOffset);
-  uint32_t nalRefIdc = extract(buf, 2, bitOffset);
-  uint32_t nalUnitType = extract(buf, 5, bitOffset);
+  uint32_t forbiddenZeroBit = extract(buf, len, 1, bitOffset);
+  uint32_t nalRefIdc = extract(buf, len, 2, bitOffset);
+  uint32_t nalUnitType = extract(buf, len, 5, bitOffset);
 
   if(nalUnitType != 7) {
     return spsInfo;
   }
 
-  uint32_t profileIdc = extract(buf, 8, bitOffset);
+  uint32_t profileIdc = extract(buf, len, 8, bitOffset);
 
-  uint32_t constraintSet0Flag = extract(buf, 1, bitOffset);
-  uint32_t constraintSet1Flag = extract(buf, 1, bitOffset);
-  uint32_t constraintSet2Flag = extract(buf, 1, bitOffset);
-  uint32_t constraintSet3Flag = extract(buf, 1, bitOffset);
+  uint32_t constraintSet0Flag = extract(buf, len, 1, bitOffset);
+  uint32_t constraintSet1Flag = extract(buf, len, 1, bitOffset);
+  uint32_t constraintSet2Flag = extract(buf, len, 1, bitOffset);
+  uint32_t constraintSet3Flag = extract(buf, len, 1, bitOffset);
   
-  uint32_t reservedBits = extract(buf, 4, bitOffset);
-  uint32_t levelIdc = extract(buf, 8, bitOffset);
+  uint32_t reservedBits = extract(buf, len, 4, bitOffset);
+  uint32_t levelIdc = extract(buf, len, 8, bitOffset);
 
   uint32_t seqParameterSetId = extractUnsignedExpGolomb(buf, len, bitOffset);
 
+  uint32_t chromaFormatIdc = 1;
   if (profileIdc == 100 || profileIdc == 110 || profileIdc == 122 
-      || profileIdc == 144 ) {
+      || profileIdc == 244 || profileIdc == 44 || profileIdc == 83
+      || profileIdc == 86 || profileIdc == 118 || profileIdc == 128
+      || profileIdc == 138 || profileIdc == 139 || profileIdc == 134
+      || profileIdc == 135 || profileIdc == 144) {
     
-    uint32_t chromaFormatIdc = extractUnsignedExpGolomb(buf, len, bitOffset);
+    chromaFormatIdc = extractUnsignedExpGolomb(buf, len, bitOffset);
     if (chromaFormatIdc == 3 ) {
-      uint32_t residualColourTransformFlag = extract(buf, 1, bitOffset);
+      uint32_t residualColourTransformFlag = extract(buf, len, 1, bitOffset);
     }
 
     uint32_t bitDepthLumaMinus8 = extractUnsignedExpGolomb(buf, len,bitOffset);
     uint32_t bitDepthChromaMinus8 = extractUnsignedExpGolomb(buf, len,
         bitOffset);
-    uint32_t qpprimeYZeroTransformBypassFlag = extract(buf, 1, bitOffset);
-    uint32_t seqScalingMatrixPresentFlag = extract(buf, 1, bitOffset);
+    uint32_t qpprimeYZeroTransformBypassFlag = extract(buf, len, 1, bitOffset);
+    uint32_t seqScalingMatrixPresentFlag = extract(buf, len, 1, bitOffset);
 
-    uint32_t seqScalingListPresentFlag[8];
     if (seqScalingMatrixPresentFlag) {
-      for (uint32_t i = 0; i < 8; ++i) {
-        seqScalingListPresentFlag[i] = extract(buf, 1, bitOffset);
+      uint32_t const scalingListCount = (chromaFormatIdc != 3) ? 8 : 12;
+      for (uint32_t i = 0; i < scalingListCount; ++i) {
+        uint32_t seqScalingListPresentFlag = extract(buf, len, 1, bitOffset);
+        if (seqScalingListPresentFlag) {
+          // scaling_list(): the delta coded entries up to the first one that
+          // repeats the rest.
+          uint32_t const size = (i < 6) ? 16 : 64;
+          int32_t lastScale = 8;
+          int32_t nextScale = 8;
+          for (uint32_t j = 0; j < size && nextScale != 0; ++j) {
+            int32_t deltaScale = extractSignedExpGolomb(buf, len, bitOffset);
+            nextScale = (lastScale + deltaScale + 256) % 256;
+            lastScale = (nextScale == 0) ? lastScale : nextScale;
+          }
+        }
       }
     }
   }
@@ -134,7 +179,7 @@ inline SpsInfo decodeSps(uint8_t const *buf, uint32_t const len)
     uint32_t log2MaxPicOrderCntLsbMinus4 = 
       extractUnsignedExpGolomb(buf, len, bitOffset);
   } else if (picOrderCntType == 1) {
-    uint32_t deltaPicOrderAlwaysZeroFlag = extract(buf, 1, bitOffset);
+    uint32_t deltaPicOrderAlwaysZeroFlag = extract(buf, len, 1, bitOffset);
     int32_t offsetForNonRefPic = extractSignedExpGolomb(buf, len, bitOffset);
     int32_t offsetForTopToBottomField = extractSignedExpGolomb(buf, len,
         bitOffset);
@@ -148,58 +193,78 @@ inline SpsInfo decodeSps(uint8_t const *buf, uint32_t const len)
     delete [] offsetForRefFrame;
   }
   uint32_t numRefFrames = extractUnsignedExpGolomb(buf, len, bitOffset);
-  uint32_t gapsInFrameNumValueAllowedFlag = extract(buf, 1, bitOffset);
+  uint32_t gapsInFrameNumValueAllowedFlag = extract(buf, len, 1, bitOffset);
   uint32_t picWidthInMbsMinus1 = extractUnsignedExpGolomb(buf, len, bitOffset);
   uint32_t picHeightInMapUnitsMinus1 = 
     extractUnsignedExpGolomb(buf, len, bitOffset);
 
+  uint32_t frameMbsOnlyFlag = extract(buf, len, 1, bitOffset);
+
+  // Interlaced map units are pairs of macroblocks.
   spsInfo.width = (picWidthInMbsMinus1 + 1) * 16;
-  spsInfo.height = (picHeightInMapUnitsMinus1 + 1) * 16;
+  spsInfo.height = (2 - frameMbsOnlyFlag) * (picHeightInMapUnitsMinus1 + 1)
+    * 16;
 
-  uint32_t frameMbsOnlyFlag = extract(buf, 1, bitOffset);
   if (!frameMbsOnlyFlag) {
-    uint32_t mbAdaptiveFrameFieldFlag = extract(buf, 1, bitOffset);
+    uint32_t mbAdaptiveFrameFieldFlag = extract(buf, len, 1, bitOffset);
   }
 
-  uint32_t direct8x8InferenceFlag = extract(buf, 1, bitOffset);
-  uint32_t frameCroppingFlag = extract(buf, 1, bitOffset);
+  uint32_t direct8x8InferenceFlag = extract(buf, len, 1, bitOffset);
+  uint32_t frameCroppingFlag = extract(buf, len, 1, bitOffset);
   if (frameCroppingFlag) {
     uint32_t frameCropLeftOffset = extractUnsignedExpGolomb(buf, len, bitOffset);
     uint32_t frameCropRightOffset = extractUnsignedExpGolomb(buf, len, bitOffset);
     uint32_t frameCropTopOffset = extractUnsignedExpGolomb(buf, len, bitOffset);
     uint32_t frameCropBottomOffset = extractUnsignedExpGolomb(buf, len, bitOffset);
+    // The offsets count chroma samples, and rows of fields if interlaced,
+    // e.g. 4 for the 8 padding rows of a 1920x1088 coded 1080p stream.
+    uint32_t const cropUnitX = (chromaFormatIdc == 1 || chromaFormatIdc == 2)
+      ? 2 : 1;
+    uint32_t const cropUnitY = ((chromaFormatIdc == 1) ? 2 : 1)
+      * (2 - frameMbsOnlyFlag);
+    uint32_t const cropWidth = cropUnitX
+      * (frameCropLeftOffset + frameCropRightOffset);
+    uint32_t const cropHeight = cropUnitY
+      * (frameCropTopOffset + frameCropBottomOffset);
+    if (cropWidth < spsInfo.width && cropHeight < spsInfo.height) {
+      spsInfo.width -= cropWidth;
+      spsInfo.height -= cropHeight;
+    }
+  }
+  if (bitOffset > len * 8) {
+    return SpsInfo{0, 0, 0};
   }
 
-  uint32_t vuiParameterPresentFlag = extract(buf, 1, bitOffset);
+  uint32_t vuiParameterPresentFlag = extract(buf, len, 1, bitOffset);
   if (vuiParameterPresentFlag) {
-    uint32_t aspectRatioInfoPresentFlag = extract(buf, 1, bitOffset);
+    uint32_t aspectRatioInfoPresentFlag = extract(buf, len, 1, bitOffset);
     if (aspectRatioInfoPresentFlag) {
-      uint32_t aspectRatioIdc = extract(buf, 8, bitOffset);
+      uint32_t aspectRatioIdc = extract(buf, len, 8, bitOffset);
       if (aspectRatioIdc == 255) {
-        uint32_t sarWidth = extract(buf, 16, bitOffset);
-        uint32_t sarHeight = extract(buf, 16, bitOffset);
+        uint32_t sarWidth = extract(buf, len, 16, bitOffset);
+        uint32_t sarHeight = extract(buf, len, 16, bitOffset);
       }
     }
 
-    uint32_t overscanInfoPresentFlag = extract(buf, 1, bitOffset);
+    uint32_t overscanInfoPresentFlag = extract(buf, len, 1, bitOffset);
     if (overscanInfoPresentFlag) {
-      uint32_t overscanAppropriateFlagu = extract(buf, 1, bitOffset);
+      uint32_t overscanAppropriateFlagu = extract(buf, len, 1, bitOffset);
     }
 
-    uint32_t videoSignalTypePresentFlag = extract(buf, 1, bitOffset);
+    uint32_t videoSignalTypePresentFlag = extract(buf, len, 1, bitOffset);
     if (videoSignalTypePresentFlag) {
-      uint32_t videoFormat = extract(buf, 3, bitOffset);
-      uint32_t videoFullRangeFlag = extract(buf, 1, bitOffset);
+      uint32_t videoFormat = extract(buf, len, 3, bitOffset);
+      uint32_t videoFullRangeFlag = extract(buf, len, 1, bitOffset);
 
-      uint32_t colourDescriptionPresentFlag = extract(buf, 1, bitOffset);
+      uint32_t colourDescriptionPresentFlag = extract(buf, len, 1, bitOffset);
       if (colourDescriptionPresentFlag) {
-        uint32_t colourPrimaries = extract(buf, 8, bitOffset);
-        uint32_t transferCharacteristics = extract(buf, 8, bitOffset);
-        uint32_t matrixCoefficients = extract(buf, 8, bitOffset);
+        uint32_t colourPrimaries = extract(buf, len, 8, bitOffset);
+        uint32_t transferCharacteristics = extract(buf, len, 8, bitOffset);
+        uint32_t matrixCoefficients = extract(buf, len, 8, bitOffset);
       }
     }
     
-    uint32_t chromaLocInfoPresentFlag = extract(buf, 1, bitOffset);
+    uint32_t chromaLocInfoPresentFlag = extract(buf, len, 1, bitOffset);
     if (chromaLocInfoPresentFlag) {
       uint32_t chromaSampleLocTypeTopField = 
         extractUnsignedExpGolomb(buf, len, bitOffset);
@@ -207,12 +272,12 @@ inline SpsInfo decodeSps(uint8_t const *buf, uint32_t const len)
         extractUnsignedExpGolomb(buf, len, bitOffset);
     }
 
-    uint32_t timingInfoPresentFlag = extract(buf, 1, bitOffset);
+    uint32_t timingInfoPresentFlag = extract(buf, len, 1, bitOffset);
     if (timingInfoPresentFlag) {
-      uint32_t numUnitsInTick = extract(buf, 32, bitOffset);
-      uint32_t timeScale = extract(buf, 32, bitOffset);
-      uint32_t fps = timeScale / numUnitsInTick;
-      uint32_t fixedFrameRateFlag = extract(buf, 1, bitOffset);
+      uint32_t numUnitsInTick = extract(buf, len, 32, bitOffset);
+      uint32_t timeScale = extract(buf, len, 32, bitOffset);
+      uint32_t fps = (0 != numUnitsInTick) ? timeScale / numUnitsInTick : 0;
+      uint32_t fixedFrameRateFlag = extract(buf, len, 1, bitOffset);
       if (fixedFrameRateFlag) {
         fps = fps / 2;
       }
@@ -223,4 +288,100 @@ inline SpsInfo decodeSps(uint8_t const *buf, uint32_t const len)
   return spsInfo;
 }
 
+// The H.265 sequence parameter set (ITU-T H.265, 7.3.2.2), as far as needed
+// for the picture size; the conformance window is applied.
+inline SpsInfo decodeHevcSps(uint8_t const *nal, uint32_t const nalLen)
+{
+  SpsInfo spsInfo{0, 0, 0};
+
+  std::string const rbsp{removeEmulationPrevention(nal, nalLen)};
+  uint8_t const *buf = reinterpret_cast<uint8_t const *>(rbsp.data());
+  uint32_t const len = static_cast<uint32_t>(rbsp.size());
+  if (len < 16) {
+    return spsInfo;
+  }
+
+  uint32_t bitOffset = 0;
+
+  // The NAL unit header: forbidden_zero_bit, nal_unit_type, nuh_layer_id and
+  // nuh_temporal_id_plus1.
+  bitOffset += 1;
+  uint32_t nalUnitType = extract(buf, len, 6, bitOffset);
+  bitOffset += 9;
+
+  if (nalUnitType != 33) {
+    return spsInfo;
+  }
+
+  // sps_video_parameter_set_id, sps_max_sub_layers_minus1 and
+  // sps_temporal_id_nesting_flag.
+  bitOffset += 4;
+  uint32_t spsMaxSubLayersMinus1 = extract(buf, len, 3, bitOffset);
+  bitOffset += 1;
+
+  // profile_tier_level: the general profile (88 bits) and level (8 bits),
+  // then the presence flags and profiles of the sub-layers.
+  bitOffset += 96;
+  uint32_t subLayerProfilePresentFlag[8];
+  uint32_t subLayerLevelPresentFlag[8];
+  for (uint32_t i = 0; i < spsMaxSubLayersMinus1; ++i) {
+    subLayerProfilePresentFlag[i] = extract(buf, len, 1, bitOffset);
+    subLayerLevelPresentFlag[i] = extract(buf, len, 1, bitOffset);
+  }
+  if (spsMaxSubLayersMinus1 > 0) {
+    bitOffset += 2 * (8 - spsMaxSubLayersMinus1);
+  }
+  for (uint32_t i = 0; i < spsMaxSubLayersMinus1; ++i) {
+    if (subLayerProfilePresentFlag[i]) {
+      bitOffset += 88;
+    }
+    if (subLayerLevelPresentFlag[i]) {
+      bitOffset += 8;
+    }
+  }
+
+  // sps_seq_parameter_set_id
+  extractUnsignedExpGolomb(buf, len, bitOffset);
+  uint32_t chromaFormatIdc = extractUnsignedExpGolomb(buf, len, bitOffset);
+  // Separately coded colour planes are each monochrome (ChromaArrayType 0).
+  uint32_t chromaArrayType = chromaFormatIdc;
+  if (chromaFormatIdc == 3 && extract(buf, len, 1, bitOffset)) {
+    chromaArrayType = 0;
+  }
+  uint32_t picWidthInLumaSamples = extractUnsignedExpGolomb(buf, len,
+      bitOffset);
+  uint32_t picHeightInLumaSamples = extractUnsignedExpGolomb(buf, len,
+      bitOffset);
+
+  spsInfo.width = picWidthInLumaSamples;
+  spsInfo.height = picHeightInLumaSamples;
+
+  uint32_t conformanceWindowFlag = extract(buf, len, 1, bitOffset);
+  if (conformanceWindowFlag) {
+    uint32_t confWinLeftOffset = extractUnsignedExpGolomb(buf, len, bitOffset);
+    uint32_t confWinRightOffset = extractUnsignedExpGolomb(buf, len, bitOffset);
+    uint32_t confWinTopOffset = extractUnsignedExpGolomb(buf, len, bitOffset);
+    uint32_t confWinBottomOffset = extractUnsignedExpGolomb(buf, len,
+        bitOffset);
+    // The offsets count chroma samples, or luma samples without chroma
+    // subsampling.
+    uint32_t const subWidthC = (chromaArrayType == 1 || chromaArrayType == 2)
+      ? 2 : 1;
+    uint32_t const subHeightC = (chromaArrayType == 1) ? 2 : 1;
+    uint32_t const cropWidth = subWidthC
+      * (confWinLeftOffset + confWinRightOffset);
+    uint32_t const cropHeight = subHeightC
+      * (confWinTopOffset + confWinBottomOffset);
+    if (cropWidth < spsInfo.width && cropHeight < spsInfo.height) {
+      spsInfo.width -= cropWidth;
+      spsInfo.height -= cropHeight;
+    }
+  }
+  if (bitOffset > len * 8) {
+    return SpsInfo{0, 0, 0};
+  }
+
+  return spsInfo;
+}
+
 #endif
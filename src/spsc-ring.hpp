@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// A bounded lock-free queue for exactly one producer and one consumer thread.
+// The capacity is rounded up to a power of two. Head and tail are kept on
+// separate cache lines, and each side caches the other side's index so that
+// the shared one is only read when the ring looks full or empty.
+template <typename T>
+class SpscRing {
+ private:
+  SpscRing(SpscRing const &) = delete;
+  SpscRing(SpscRing &&) = delete;
+  SpscRing &operator=(SpscRing const &) = delete;
+  SpscRing &operator=(SpscRing &&) = delete;
+
+ public:
+  explicit SpscRing(uint32_t capacity)
+    : m_slots(roundUp(capacity))
+    , m_mask(static_cast<uint32_t>(m_slots.size()) - 1)
+    , m_sharedPadding()
+    , m_head(0)
+    , m_cachedTail(0)
+    , m_consumerPadding()
+    , m_tail(0)
+    , m_cachedHead(0)
+    , m_producerPadding()
+  {
+  }
+
+  // Producer side; returns false if the ring is full.
+  bool push(T &&item)
+  {
+    uint32_t const tail{m_tail.load(std::memory_order_relaxed)};
+    if (tail - m_cachedHead > m_mask) {
+      m_cachedHead = m_head.load(std::memory_order_acquire);
+      if (tail - m_cachedHead > m_mask) {
+        return false;
+      }
+    }
+    m_slots[tail & m_mask] = std::move(item);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side; returns false if the ring is empty.
+  bool pop(T &item)
+  {
+    uint32_t const head{m_head.load(std::memory_order_relaxed)};
+    if (head == m_cachedTail) {
+      m_cachedTail = m_tail.load(std::memory_order_acquire);
+      if (head == m_cachedTail) {
+        return false;
+      }
+    }
+    item = std::move(m_slots[head & m_mask]);
+    m_slots[head & m_mask] = T();
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool isEmpty() const
+  {
+    return m_head.load(std::memory_order_acquire)
+      == m_tail.load(std::memory_order_acquire);
+  }
+
+ private:
+  static constexpr uint32_t CACHE_LINE{64};
+
+  static uint32_t roundUp(uint32_t capacity)
+  {
+    uint32_t size{1};
+    while (size < capacity) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  std::vector<T> m_slots;
+  uint32_t const m_mask;
+  char m_sharedPadding[CACHE_LINE];
+
+  // Written by the consumer.
+  std::atomic<uint32_t> m_head;
+  uint32_t m_cachedTail;
+  char m_consumerPadding[CACHE_LINE];
+
+  // Written by the producer.
+  std::atomic<uint32_t> m_tail;
+  uint32_t m_cachedHead;
+  char m_producerPadding[CACHE_LINE];
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREAD_TUNING_HPP
+#define THREAD_TUNING_HPP
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Parses a CPU list such as "2,3" or "0-3,6" into the individual core ids.
+inline std::vector<int32_t> parseCpuList(std::string const &str)
+{
+  std::vector<int32_t> cpus;
+  std::istringstream sstr(str);
+  std::string token;
+  while (std::getline(sstr, token, ',')) {
+    if (token.empty()) {
+      continue;
+    }
+    size_t const dash = token.find('-');
+    if (dash == std::string::npos) {
+      cpus.push_back(std::stoi(token));
+    } else {
+      int32_t const first = std::stoi(token.substr(0, dash));
+      int32_t const last = std::stoi(token.substr(dash + 1));
+      for (int32_t cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  return cpus;
+}
+
+// Restricts the calling thread to the given cores; an empty list leaves the
+// affinity untouched.
+inline bool pinCurrentThread(std::vector<int32_t> const &cpus)
+{
+  if (cpus.empty()) {
+    return true;
+  }
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  for (int32_t cpu : cpus) {
+    CPU_SET(cpu, &cpuSet);
+  }
+  return 0 == pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+      &cpuSet);
+}
+
+// Switches the calling thread to SCHED_FIFO with the given priority (1-99); a
+// priority of 0 leaves the thread in the default time-sharing class.
+inline bool setCurrentThreadPriority(int32_t priority)
+{
+  if (priority <= 0) {
+    return true;
+  }
+  struct sched_param param;
+  std::memset(&param, 0, sizeof(param));
+  param.sched_priority = priority;
+  return 0 == pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+}
+
+// Keeps all current and future pages resident so that page faults can not
+// stall the receive and decode threads.
+inline bool lockAllMemory()
+{
+  return 0 == mlockall(MCL_CURRENT | MCL_FUTURE);
+}
+
+// Threads started by cluon inherit the affinity and scheduling of the thread
+// creating them, so the calling thread temporarily takes on the wanted
+// settings while they are spawned and gets its own back afterwards.
+class ScopedThreadTuning {
+ private:
+  ScopedThreadTuning(ScopedThreadTuning const &) = delete;
+  ScopedThreadTuning(ScopedThreadTuning &&) = delete;
+  ScopedThreadTuning &operator=(ScopedThreadTuning const &) = delete;
+  ScopedThreadTuning &operator=(ScopedThreadTuning &&) = delete;
+
+ public:
+  ScopedThreadTuning(std::vector<int32_t> const &cpus, int32_t priority)
+    : m_cpuSet()
+    , m_policy(SCHED_OTHER)
+    , m_param()
+  {
+    pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &m_cpuSet);
+    pthread_getschedparam(pthread_self(), &m_policy, &m_param);
+
+    if (!pinCurrentThread(cpus)) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not set CPU affinity."
+        << std::endl;
+    }
+    if (!setCurrentThreadPriority(priority)) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not set SCHED_FIFO "
+        << "priority " << priority << "." << std::endl;
+    }
+  }
+
+  ~ScopedThreadTuning()
+  {
+    pthread_setschedparam(pthread_self(), m_policy, &m_param);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &m_cpuSet);
+  }
+
+ private:
+  cpu_set_t m_cpuSet;
+  int m_policy;
+  struct sched_param m_param;
+};
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spsc-ring.hpp"
+#include "thread-tuning.hpp"
+
+// A fixed set of worker threads, each optionally pinned to one core and run
+// with SCHED_FIFO priority. Every producer (stream) connects to one worker and
+// gets its own bounded single-producer/single-consumer ring into it, so that
+// everything posted by one stream runs in order on the same thread; this keeps
+// the per-stream decoder and shared memory free of locking while the streams
+// share the threads.
+//
+// Posting takes no lock. An idle worker sleeps in a read of its eventfd, and
+// producers only write to the eventfd when the worker has announced that it
+// is going to sleep. With a spin time, a worker that ran out of jobs keeps
+// polling its rings for that long before it goes to sleep, trading a busy
+// core for the wakeup latency.
+class WorkerPool {
+ private:
+  WorkerPool(WorkerPool const &) = delete;
+  WorkerPool(WorkerPool &&) = delete;
+  WorkerPool &operator=(WorkerPool const &) = delete;
+  WorkerPool &operator=(WorkerPool &&) = delete;
+
+  struct Worker;
+
+ public:
+  using Job = std::function<void()>;
+
+  // The posting end of one ring; only to be used from a single thread.
+  class Producer {
+   public:
+    Producer()
+      : m_worker(nullptr)
+      , m_ring(nullptr)
+    {
+    }
+
+    Producer(Worker *worker, std::shared_ptr<SpscRing<Job>> ring)
+      : m_worker(worker)
+      , m_ring(ring)
+    {
+    }
+
+    Producer(Producer const &) = default;
+    Producer &operator=(Producer const &) = default;
+
+    // Returns false if the ring is full, in which case the job is left
+    // untouched.
+    bool post(Job &&job)
+    {
+      if (!m_ring->push(std::move(job))) {
+        return false;
+      }
+      // Pairs with the fence in run(): either the worker sees the new job
+      // before going to sleep, or we see that it sleeps. Only the first
+      // producer to see it asleep writes to the eventfd, so a burst of
+      // posts costs one wakeup.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (m_worker->isSleeping.load(std::memory_order_relaxed)
+          && m_worker->isSleeping.exchange(false)) {
+        wake(*m_worker);
+      }
+      return true;
+    }
+
+   private:
+    Worker *m_worker;
+    std::shared_ptr<SpscRing<Job>> m_ring;
+  };
+
+  WorkerPool(uint32_t size, std::vector<int32_t> const &cpus,
+      int32_t priority, std::chrono::microseconds const &spinTime)
+    : m_workers()
+  {
+    for (uint32_t i = 0; i < size; ++i) {
+      m_workers.emplace_back(new Worker);
+    }
+    for (uint32_t i = 0; i < size; ++i) {
+      std::vector<int32_t> workerCpus;
+      if (!cpus.empty()) {
+        workerCpus.push_back(cpus[i % cpus.size()]);
+      }
+      Worker *worker = m_workers[i].get();
+      worker->thread = std::thread([worker, workerCpus, priority, spinTime]() {
+          if (!pinCurrentThread(workerCpus)) {
+            std::cerr << "[opendlv-device-camera-rtp]: Could not pin worker "
+              << "to CPU " << workerCpus[0] << "." << std::endl;
+          }
+          if (!setCurrentThreadPriority(priority)) {
+            std::cerr << "[opendlv-device-camera-rtp]: Could not set SCHED_FIFO "
+              << "priority " << priority << " for worker." << std::endl;
+          }
+          run(*worker, spinTime);
+        });
+    }
+  }
+
+  ~WorkerPool()
+  {
+    stop();
+  }
+
+  uint32_t size() const
+  {
+    return static_cast<uint32_t>(m_workers.size());
+  }
+
+  // Adds a ring of the given capacity into the worker.
+  Producer connect(uint32_t index, uint32_t capacity)
+  {
+    Worker &worker = *m_workers[index % m_workers.size()];
+    std::shared_ptr<SpscRing<Job>> ring{
+      std::make_shared<SpscRing<Job>>(capacity)};
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.rings.push_back(ring);
+      worker.hasNewRings.store(true);
+    }
+    wake(worker);
+    return Producer(&worker, ring);
+  }
+
+  // Blocks until every job posted so far has been run, waiting for each
+  // worker to announce that it goes to sleep.
+  void drain()
+  {
+    for (auto &worker : m_workers) {
+      std::unique_lock<std::mutex> lock(worker->mutex);
+      Worker *w = worker.get();
+      worker->idle.wait(lock, [w]() {
+          return !w->running.load() || isIdle(*w);
+        });
+    }
+  }
+
+  // Finishes the jobs already running and drops the queued ones.
+  void stop()
+  {
+    for (auto &worker : m_workers) {
+      worker->running.store(false);
+      wake(*worker);
+    }
+    for (auto &worker : m_workers) {
+      if (worker->thread.joinable()) {
+        worker->thread.join();
+      }
+    }
+  }
+
+ private:
+  struct Worker {
+    Worker()
+      : eventFd(::eventfd(0, EFD_CLOEXEC))
+    {
+    }
+
+    ~Worker()
+    {
+      ::close(eventFd);
+    }
+
+    int32_t eventFd;
+    std::atomic<bool> isSleeping{false};
+    std::atomic<bool> running{true};
+    std::atomic<bool> hasNewRings{false};
+    std::mutex mutex{};
+    // Notified under the mutex when the worker goes to sleep or stops.
+    std::condition_variable idle{};
+    std::vector<std::shared_ptr<SpscRing<Job>>> rings{};
+    std::thread thread{};
+  };
+
+  static void wake(Worker &worker)
+  {
+    uint64_t const one{1};
+    if (static_cast<ssize_t>(sizeof(one))
+        != ::write(worker.eventFd, &one, sizeof(one))) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not wake worker."
+        << std::endl;
+    }
+  }
+
+  // Has to be called with the worker's mutex held.
+  static bool isIdle(Worker &worker)
+  {
+    if (!worker.isSleeping.load()) {
+      return false;
+    }
+    for (auto const &ring : worker.rings) {
+      if (!ring->isEmpty()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static void run(Worker &worker, std::chrono::microseconds const &spinTime)
+  {
+    std::vector<std::shared_ptr<SpscRing<Job>>> rings;
+    auto hasWork = [&worker, &rings]() {
+        if (!worker.running.load() || worker.hasNewRings.load()) {
+          return true;
+        }
+        for (auto const &ring : rings) {
+          if (!ring->isEmpty()) {
+            return true;
+          }
+        }
+        return false;
+      };
+
+    auto lastJob = std::chrono::steady_clock::now();
+    while (worker.running.load()) {
+      if (worker.hasNewRings.exchange(false)) {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        rings = worker.rings;
+      }
+
+      // One job per ring and round, so that no stream starves the others.
+      bool hasRun{false};
+      for (auto const &ring : rings) {
+        Job job;
+        if (ring->pop(job)) {
+          job();
+          hasRun = true;
+        }
+      }
+      if (hasRun) {
+        if (spinTime.count() > 0) {
+          lastJob = std::chrono::steady_clock::now();
+        }
+        continue;
+      }
+      if (spinTime.count() > 0
+          && std::chrono::steady_clock::now() - lastJob < spinTime) {
+        continue;
+      }
+
+      worker.isSleeping.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!hasWork()) {
+        notifyIdle(worker);
+        uint64_t wakeups;
+        if (static_cast<ssize_t>(sizeof(wakeups))
+            != ::read(worker.eventFd, &wakeups, sizeof(wakeups))) {
+          std::cerr << "[opendlv-device-camera-rtp]: Worker failed to wait."
+            << std::endl;
+        }
+      }
+      worker.isSleeping.store(false);
+    }
+    notifyIdle(worker);
+  }
+
+  static void notifyIdle(Worker &worker)
+  {
+    {
+      // Taking the mutex orders the notification after a waiter in drain()
+      // has checked the rings.
+      std::lock_guard<std::mutex> lock(worker.mutex);
+    }
+    worker.idle.notify_all();
+  }
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+};
+
+#endif
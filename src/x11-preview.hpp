@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef X11_PREVIEW_HPP
+#define X11_PREVIEW_HPP
+
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XSHM
+#include <X11/extensions/XShm.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cluon-complete.hpp"
+
+// Shows the ARGB image of a stream in an X11 window. A thread of its own
+// looks at the shared memory at the given rate (the refresh rate of the
+// display) and, when a newer image is there, copies it out under the lock
+// and blits it after releasing the lock, so that neither the decoder nor the
+// consumers of the shared memory ever wait for the X server.
+//
+// The display is opened with the first image. With the MIT-SHM extension the
+// image is copied into a segment shared with the X server and put with
+// XShmPutImage, which saves sending it over the connection; on displays
+// without it, such as remote ones, or when built without libXext, XPutImage
+// is used instead. Only displays with 32 bits per pixel, which the ARGB
+// image is copied to row by row, are supported.
+class X11Preview {
+ private:
+  X11Preview(X11Preview const &) = delete;
+  X11Preview(X11Preview &&) = delete;
+  X11Preview &operator=(X11Preview const &) = delete;
+  X11Preview &operator=(X11Preview &&) = delete;
+
+ public:
+  X11Preview(std::string const &title, cluon::SharedMemory &sharedMemory,
+      uint32_t width, uint32_t height, double rate)
+    : m_title(title)
+    , m_sharedMemory(sharedMemory)
+    , m_width(width)
+    , m_height(height)
+    , m_period(std::chrono::microseconds(static_cast<int64_t>(
+            1000000.0 / ((rate > 0.0) ? rate : 60.0))))
+    , m_display(nullptr)
+    , m_window(0)
+    , m_image(nullptr)
+#ifdef HAVE_XSHM
+    , m_shmInfo()
+#endif
+    , m_buffer()
+    , m_isShm(false)
+    , m_running(true)
+    , m_thread()
+  {
+    m_thread = std::thread([this]() { run(); });
+  }
+
+  ~X11Preview()
+  {
+    m_running.store(false);
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+ private:
+  void run()
+  {
+    cluon::data::TimeStamp shown{};
+    auto next = std::chrono::steady_clock::now();
+    while (m_running.load()) {
+      // A late frame (while the X server was busy) does not cause a burst.
+      next = std::max(next + m_period, std::chrono::steady_clock::now());
+      std::this_thread::sleep_until(next);
+
+      if (nullptr == m_display) {
+        if (!isNewer(shown)) {
+          continue;
+        }
+        if (!open()) {
+          return;
+        }
+      }
+
+      bool const isNew{copyIfNewer(shown)};
+      bool isExposed{false};
+      while (XPending(m_display) > 0) {
+        XEvent event;
+        XNextEvent(m_display, &event);
+        isExposed |= (Expose == event.type);
+      }
+      if (isNew || isExposed) {
+        put();
+      }
+    }
+    close();
+  }
+
+  bool isNewer(cluon::data::TimeStamp const &shown)
+  {
+    m_sharedMemory.lock();
+    std::pair<bool, cluon::data::TimeStamp> const current{
+      m_sharedMemory.getTimeStamp()};
+    m_sharedMemory.unlock();
+    return current.first && cluon::time::toMicroseconds(current.second)
+      != cluon::time::toMicroseconds(shown);
+  }
+
+  // Copies the image out of the shared memory if it is newer than the one
+  // shown; only the copy is done under the lock.
+  bool copyIfNewer(cluon::data::TimeStamp &shown)
+  {
+    bool isNew{false};
+    m_sharedMemory.lock();
+    {
+      std::pair<bool, cluon::data::TimeStamp> const current{
+        m_sharedMemory.getTimeStamp()};
+      isNew = current.first && cluon::time::toMicroseconds(current.second)
+        != cluon::time::toMicroseconds(shown);
+      if (isNew) {
+        // The rows of the image may be padded.
+        uint32_t const rowBytes{m_width * 4};
+        size_t const stride{static_cast<size_t>(m_image->bytes_per_line)};
+        for (uint32_t row = 0; row < m_height; ++row) {
+          std::memcpy(m_image->data + row * stride,
+              m_sharedMemory.data() + row * rowBytes, rowBytes);
+        }
+        shown = current.second;
+      }
+    }
+    m_sharedMemory.unlock();
+    return isNew;
+  }
+
+  // Opens the display and creates the window and image. The display is only
+  // tried once; without one, or without a 32 bit image format, the preview
+  // stays off.
+  bool open()
+  {
+    m_display = XOpenDisplay(nullptr);
+    if (nullptr == m_display) {
+      std::cerr << "[opendlv-device-camera-rtp]: Could not open X display for "
+        << "the preview of " << m_title << "." << std::endl;
+      return false;
+    }
+    int32_t const screen{DefaultScreen(m_display)};
+    Visual *visual{DefaultVisual(m_display, screen)};
+    int32_t const depth{DefaultDepth(m_display, screen)};
+    m_window = XCreateSimpleWindow(m_display, RootWindow(m_display, screen),
+        0, 0, m_width, m_height, 1, 0, 0);
+    XStoreName(m_display, m_window, m_title.c_str());
+    XSelectInput(m_display, m_window, ExposureMask);
+
+#ifdef HAVE_XSHM
+    m_isShm = (True == XShmQueryExtension(m_display)) && openShm(visual, depth);
+#endif
+    if (!m_isShm) {
+      m_image = XCreateImage(m_display, visual, depth, ZPixmap, 0, nullptr,
+          m_width, m_height, 32, 0);
+      if (nullptr != m_image) {
+        m_buffer.resize(static_cast<size_t>(m_image->bytes_per_line)
+            * m_height);
+        m_image->data = reinterpret_cast<char *>(m_buffer.data());
+      }
+    }
+    if (nullptr == m_image || 32 != m_image->bits_per_pixel) {
+      std::cerr << "[opendlv-device-camera-rtp]: The X display has no 32 bit "
+        << "image format for the preview of " << m_title << "." << std::endl;
+      close();
+      return false;
+    }
+    XMapWindow(m_display, m_window);
+    XFlush(m_display);
+    return true;
+  }
+
+#ifdef HAVE_XSHM
+  bool openShm(Visual *visual, int32_t depth)
+  {
+    m_image = XShmCreateImage(m_display, visual, depth, ZPixmap, nullptr,
+        &m_shmInfo, m_width, m_height);
+    if (nullptr == m_image) {
+      return false;
+    }
+    m_shmInfo.shmid = shmget(IPC_PRIVATE,
+        m_image->bytes_per_line * m_image->height, IPC_CREAT | 0600);
+    if (-1 == m_shmInfo.shmid) {
+      XDestroyImage(m_image);
+      m_image = nullptr;
+      return false;
+    }
+    void *address{shmat(m_shmInfo.shmid, nullptr, 0)};
+    bool isAttached{reinterpret_cast<void *>(-1) != address};
+    if (isAttached) {
+      m_shmInfo.shmaddr = static_cast<char *>(address);
+      m_image->data = m_shmInfo.shmaddr;
+      m_shmInfo.readOnly = False;
+      isAttached = (True == XShmAttach(m_display, &m_shmInfo));
+      XSync(m_display, False);
+      if (!isAttached) {
+        shmdt(address);
+      }
+    }
+    // The segment goes away once both sides have detached.
+    shmctl(m_shmInfo.shmid, IPC_RMID, nullptr);
+    if (!isAttached) {
+      m_image->data = nullptr;
+      XDestroyImage(m_image);
+      m_image = nullptr;
+      return false;
+    }
+    return true;
+  }
+#endif
+
+  void put()
+  {
+    GC gc{DefaultGC(m_display, DefaultScreen(m_display))};
+#ifdef HAVE_XSHM
+    if (m_isShm) {
+      XShmPutImage(m_display, m_window, gc, m_image, 0, 0, 0, 0, m_width,
+          m_height, False);
+    } else {
+      XPutImage(m_display, m_window, gc, m_image, 0, 0, 0, 0, m_width,
+          m_height);
+    }
+#else
+    XPutImage(m_display, m_window, gc, m_image, 0, 0, 0, 0, m_width,
+        m_height);
+#endif
+    // The X server has to be done with the image before the next one is
+    // copied into it.
+    XSync(m_display, False);
+  }
+
+  void close()
+  {
+    if (nullptr == m_display) {
+      return;
+    }
+#ifdef HAVE_XSHM
+    if (m_isShm) {
+      XShmDetach(m_display, &m_shmInfo);
+      XSync(m_display, False);
+      shmdt(m_shmInfo.shmaddr);
+    }
+#endif
+    if (nullptr != m_image) {
+      // The image data is not owned by Xlib.
+      m_image->data = nullptr;
+      XDestroyImage(m_image);
+      m_image = nullptr;
+    }
+    XDestroyWindow(m_display, m_window);
+    XCloseDisplay(m_display);
+    m_display = nullptr;
+  }
+
+  std::string const m_title;
+  cluon::SharedMemory &m_sharedMemory;
+  uint32_t const m_width;
+  uint32_t const m_height;
+  std::chrono::microseconds const m_period;
+  Display *m_display;
+  Window m_window;
+  XImage *m_image;
+#ifdef HAVE_XSHM
+  XShmSegmentInfo m_shmInfo;
+#endif
+  std::vector<uint8_t> m_buffer;
+  bool m_isShm;
+  std::atomic<bool> m_running;
+  std::thread m_thread;
+};
+
+#endif
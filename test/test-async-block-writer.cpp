@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "async-block-writer.hpp"
+
+// Writes blocks through the AsyncBlockWriter (io_uring when built with
+// liburing, the writer thread otherwise) and checks the file. The file size
+// limit then cuts a block short, which has to be written up to the limit by
+// resubmitting the rest, after which the next attempt fails with EFBIG and
+// has to be reported by wait().
+
+static uint32_t const BLOCK_BYTES{1024 * 1024};
+static uint32_t const BLOCK_COUNT{8};
+
+static char valueAt(uint64_t offset)
+{
+  return static_cast<char>((offset * 31) >> 3);
+}
+
+static bool isFileAsWritten(std::string const &name, uint64_t size)
+{
+  int32_t const fd{::open(name.c_str(), O_RDONLY)};
+  struct stat info;
+  if (-1 == fd || 0 != ::fstat(fd, &info)
+      || static_cast<uint64_t>(info.st_size) != size) {
+    std::cerr << "Expected " << size << " bytes in " << name << "."
+      << std::endl;
+    if (-1 != fd) {
+      ::close(fd);
+    }
+    return false;
+  }
+  std::vector<char> data(size);
+  bool isEqual{static_cast<ssize_t>(size) == ::pread(fd, data.data(), size, 0)};
+  for (uint64_t i = 0; isEqual && i < size; ++i) {
+    isEqual = (valueAt(i) == data[i]);
+  }
+  ::close(fd);
+  if (!isEqual) {
+    std::cerr << "The content of " << name << " differs." << std::endl;
+  }
+  return isEqual;
+}
+
+int32_t main()
+{
+  char name[] = "/tmp/test-async-block-writer-XXXXXX";
+  int32_t const fd{mkstemp(name)};
+  if (-1 == fd) {
+    std::cerr << "Could not create a temporary file." << std::endl;
+    return 1;
+  }
+
+  std::vector<std::vector<char>> blocks(2, std::vector<char>(BLOCK_BYTES));
+  int32_t failures{0};
+  {
+    AsyncBlockWriter writer(fd, 2);
+    for (uint32_t i = 0; i < BLOCK_COUNT; ++i) {
+      uint32_t const slot{i % 2};
+      if (!writer.wait(slot)) {
+        std::cerr << "Writing block " << i << " failed." << std::endl;
+        failures++;
+        break;
+      }
+      uint64_t const offset{static_cast<uint64_t>(i) * BLOCK_BYTES};
+      for (uint32_t j = 0; j < BLOCK_BYTES; ++j) {
+        blocks[slot][j] = valueAt(offset + j);
+      }
+      writer.submit(slot, blocks[slot].data(), BLOCK_BYTES, offset);
+    }
+  }
+  if (!isFileAsWritten(name, static_cast<uint64_t>(BLOCK_COUNT) * BLOCK_BYTES)) {
+    failures++;
+  }
+
+  // Half of the next block fits below the limit.
+  uint64_t const offset{static_cast<uint64_t>(BLOCK_COUNT) * BLOCK_BYTES};
+  uint64_t const limit{offset + BLOCK_BYTES / 2};
+  std::signal(SIGXFSZ, SIG_IGN);
+  struct rlimit fileSize;
+  ::getrlimit(RLIMIT_FSIZE, &fileSize);
+  fileSize.rlim_cur = limit;
+  ::setrlimit(RLIMIT_FSIZE, &fileSize);
+  {
+    AsyncBlockWriter writer(fd, 1);
+    for (uint32_t j = 0; j < BLOCK_BYTES; ++j) {
+      blocks[0][j] = valueAt(offset + j);
+    }
+    writer.submit(0, blocks[0].data(), BLOCK_BYTES, offset);
+    if (writer.wait(0)) {
+      std::cerr << "Writing beyond the file size limit did not fail."
+        << std::endl;
+      failures++;
+    }
+  }
+  if (!isFileAsWritten(name, limit)) {
+    failures++;
+  }
+
+  ::close(fd);
+  ::unlink(name);
+#ifdef HAVE_LIBURING
+  std::cout << "io_uring: ";
+#else
+  std::cout << "Writer thread: ";
+#endif
+  std::cout << ((0 == failures) ? "passed." : "failed.") << std::endl;
+  return (0 == failures) ? 0 : 1;
+}
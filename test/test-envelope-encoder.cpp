@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2019 Ola Benderius
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "cluon-complete.hpp"
+#include "envelope-encoder.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "recording-file.hpp"
+
+// Checks that a frame written as head, data and tail with writev gives the
+// same bytes as cluon::serializeEnvelope, for data sizes on both sides of
+// the varint length boundaries of the ImageReading and the Envelope.
+
+static std::string serializeWithCluon(std::string const &data,
+    cluon::data::TimeStamp const &sent,
+    cluon::data::TimeStamp const &sampleTimeStamp)
+{
+  opendlv::proxy::ImageReading ir;
+  ir.fourcc("h264").width(1920).height(1080).data(data);
+
+  cluon::data::Envelope envelope;
+  {
+    cluon::ToProtoVisitor protoEncoder;
+    envelope.dataType(ir.ID());
+    ir.accept(protoEncoder);
+    envelope.serializedData(protoEncoder.encodedData());
+    envelope.sent(sent);
+    envelope.sampleTimeStamp(sampleTimeStamp);
+    envelope.senderStamp(3);
+  }
+  return cluon::serializeEnvelope(std::move(envelope));
+}
+
+static bool writeWithWritev(std::string const &name, std::string const &data,
+    cluon::data::TimeStamp const &sent,
+    cluon::data::TimeStamp const &sampleTimeStamp, std::string &out)
+{
+  std::string head;
+  std::string tail;
+  if (!encodeImageReadingEnvelope("h264", 1920, 1080, data.size(), sent,
+        sampleTimeStamp, 3, head, tail)) {
+    return false;
+  }
+  {
+    RecordingFile file(name, 0, false);
+    struct iovec iov[3];
+    iov[0].iov_base = const_cast<char *>(head.data());
+    iov[0].iov_len = head.size();
+    iov[1].iov_base = const_cast<char *>(data.data());
+    iov[1].iov_len = data.size();
+    iov[2].iov_base = const_cast<char *>(tail.data());
+    iov[2].iov_len = tail.size();
+    if (!file.write(iov, 3)) {
+      return false;
+    }
+  }
+  std::ifstream in(name, std::ios::binary);
+  out.assign(std::istreambuf_iterator<char>(in),
+      std::istreambuf_iterator<char>());
+  return true;
+}
+
+int32_t main()
+{
+  char name[] = "/tmp/test-envelope-encoder-XXXXXX";
+  int32_t const fd{mkstemp(name)};
+  if (-1 == fd) {
+    std::cerr << "Could not create a temporary file." << std::endl;
+    return 1;
+  }
+  ::close(fd);
+
+  // The data length crosses a varint boundary at 128, 16384 and 2097152
+  // bytes; the length of the ImageReading, which carries some more bytes,
+  // crosses it a little earlier, so a range around each is tested.
+  std::vector<uint64_t> sizes{0, 1};
+  for (uint64_t const boundary : {128ULL, 16384ULL, 2097152ULL}) {
+    for (uint64_t size = boundary - 40; size <= boundary + 8; ++size) {
+      sizes.push_back(size);
+    }
+  }
+
+  cluon::data::TimeStamp sent;
+  sent.seconds(1570000000).microseconds(123456);
+  cluon::data::TimeStamp sampleTimeStamp;
+  sampleTimeStamp.seconds(1570000000).microseconds(98765);
+
+  int32_t failures{0};
+  for (uint64_t const size : sizes) {
+    std::string data(size, '\0');
+    for (uint64_t i = 0; i < size; ++i) {
+      data[i] = static_cast<char>(i * 7 + 1);
+    }
+    std::string const expected{
+      serializeWithCluon(data, sent, sampleTimeStamp)};
+    std::string written;
+    if (!writeWithWritev(name, data, sent, sampleTimeStamp, written)) {
+      std::cerr << "Could not encode or write " << size << " bytes."
+        << std::endl;
+      failures++;
+    } else if (written != expected) {
+      std::cerr << "Envelope of " << size << " bytes differs from "
+        << "cluon::serializeEnvelope." << std::endl;
+      failures++;
+    }
+  }
+  ::unlink(name);
+
+  std::cout << (sizes.size() - failures) << " of " << sizes.size()
+    << " data sizes give identical envelopes." << std::endl;
+  return (0 == failures) ? 0 : 1;
+}